@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# Hot-parent contention benchmark: N clients insert posts into a Zipf-skewed
+# set of topics, so most cascades fight over the lock of a few topic rows.
+# The client count is swept to show where the cascade UPDATE stops scaling.
+#
+# While pgbench runs, pg_stat_activity and pg_locks are sampled; lock_wait_s
+# is the sampled number of backends waiting on a lock integrated over time,
+# max_ungranted the most lock requests seen waiting in pg_locks at once.
+# Deadlocks come from pg_stat_database, latency percentiles from the
+# per-transaction pgbench log.
+#
+# Environment (see also lib.sh):
+#     BENCH_CLIENT_SWEEP    client counts to run (1 2 4 8 16 32 64)
+#     BENCH_SKEW            Zipf parameter of the topic choice (1.1)
+#     BENCH_SAMPLE_MS       sampling interval (100)
+#     BENCH_TRIGGERS        trigger variants to compare (plpgsql c)
+#     BENCH_SCENARIOS       pgbench scripts to run (hot_insert hot_multi)
+
+set -e
+BENCH_OUTPUT=${BENCH_OUTPUT:-$(pwd)/bench_contention.csv}
+. "$(dirname "$0")/lib.sh"
+
+BENCH_CLIENT_SWEEP=${BENCH_CLIENT_SWEEP:-1 2 4 8 16 32 64}
+BENCH_SKEW=${BENCH_SKEW:-1.1}
+BENCH_SAMPLE_MS=${BENCH_SAMPLE_MS:-100}
+BENCH_TRIGGERS=${BENCH_TRIGGERS:-plpgsql c}
+BENCH_SCENARIOS=${BENCH_SCENARIOS:-hot_insert hot_multi}
+
+# Retry deadlocked transactions where pgbench supports it (PG15+) instead
+# of aborting the client
+retries=
+if "$PG_BINDIR/pgbench" --help | grep -q -- --max-tries; then
+    retries=--max-tries=100
+fi
+
+sample_locks() {
+    interval=$(awk "BEGIN { print $BENCH_SAMPLE_MS / 1000 }")
+    while :; do
+        psql_bench -A -t -c "
+            SELECT (SELECT count(*) FROM pg_stat_activity
+                    WHERE datname = 'bench' AND wait_event_type = 'Lock'),
+                   (SELECT count(*) FROM pg_locks WHERE NOT granted)" \
+            2>/dev/null || true
+        sleep "$interval"
+    done
+}
+
+deadlocks() {
+    psql_bench -A -t -c \
+        "SELECT deadlocks FROM pg_stat_database WHERE datname = 'bench'"
+}
+
+cluster_start
+
+echo "scenario,trigger,clients,skew,transactions,failed,tps,latency_avg_ms,latency_p50_ms,latency_p95_ms,latency_p99_ms,lock_wait_s,max_waiting,max_ungranted,deadlocks" \
+    > "$BENCH_OUTPUT"
+
+for trigger in $BENCH_TRIGGERS; do
+    for scenario in $BENCH_SCENARIOS; do
+        for clients in $BENCH_CLIENT_SWEEP; do
+            load_schema "$trigger"
+            rm -f "$BENCH_TMP"/pgbench_log.*
+
+            deadlocks_before=$(deadlocks)
+            sample_locks | tr '|' ' ' > "$BENCH_TMP/samples" &
+            sampler=$!
+
+            (cd "$BENCH_TMP" && pgbench_bench -c "$clients" -j "$clients" \
+                -T "$BENCH_DURATION" -D skew="$BENCH_SKEW" $retries \
+                --log --log-prefix=pgbench_log \
+                -f "$BENCH_DIR/scripts/$scenario.sql") \
+                > "$BENCH_TMP/pgbench.out" || true
+
+            kill "$sampler" 2>/dev/null || true
+            wait "$sampler" 2>/dev/null || true
+            deadlocks_after=$(deadlocks)
+
+            lock_stats=$(awk -v ms="$BENCH_SAMPLE_MS" '
+                { waiting += $1; if ($1 > max) max = $1
+                  if ($2 > ungranted) ungranted = $2 }
+                END { printf "%.2f,%d,%d", waiting * ms / 1000, max,
+                      ungranted }' \
+                "$BENCH_TMP/samples")
+
+            # The third field of the pgbench log is the latency in us
+            percentiles=$(cat "$BENCH_TMP"/pgbench_log.* | awk '{ print $3 }' \
+                | sort -n | awk '
+                function pct(p,    i) {
+                    i = int(NR * p) + 1
+                    return latency[i > NR ? NR : i] / 1000
+                }
+                { latency[NR] = $1 }
+                END {
+                    if (NR == 0) { print ",,"; exit }
+                    printf "%.3f,%.3f,%.3f", pct(0.50), pct(0.95), pct(0.99)
+                }')
+
+            failed=$(sed -n 's/^number of failed transactions: \([0-9]*\).*/\1/p' \
+                "$BENCH_TMP/pgbench.out")
+
+            echo "$scenario,$trigger,$clients,$BENCH_SKEW,$(pgbench_field "$BENCH_TMP/pgbench.out" transactions),${failed:-0},$(pgbench_field "$BENCH_TMP/pgbench.out" tps),$(pgbench_field "$BENCH_TMP/pgbench.out" latency),$percentiles,$lock_stats,$((deadlocks_after - deadlocks_before))" \
+                >> "$BENCH_OUTPUT"
+            echo "$trigger $scenario $clients clients: $(pgbench_field "$BENCH_TMP/pgbench.out" tps) tps"
+        done
+    done
+done
+
+echo "results written to $BENCH_OUTPUT"
@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Helpers shared by the benchmark scripts: a throwaway cluster that loads the
+# freshly built cascade_timestamp.so from the source tree, the forum schema
+# and the trigger variants that get compared.
+#
+# Environment:
+#     PG_CONFIG         pg_config of the server to benchmark against
+#     BENCH_PORT        port of the throwaway cluster (54329)
+#     BENCH_SCALE       number of topics, the other tables scale along (10000)
+#     BENCH_DURATION    seconds per pgbench run (30)
+#     BENCH_OUTPUT      machine-readable results (bench_results.csv)
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+TOP_DIR=$(dirname "$BENCH_DIR")
+
+PG_CONFIG=${PG_CONFIG:-pg_config}
+PG_BINDIR=$("$PG_CONFIG" --bindir)
+BENCH_PORT=${BENCH_PORT:-54329}
+BENCH_SCALE=${BENCH_SCALE:-10000}
+BENCH_DURATION=${BENCH_DURATION:-30}
+BENCH_OUTPUT=${BENCH_OUTPUT:-$TOP_DIR/bench_results.csv}
+BENCH_TMP=$(mktemp -d "${TMPDIR:-/tmp}/cascade_timestamp_bench.XXXXXX")
+
+BENCH_TOPICS=$BENCH_SCALE
+BENCH_POSTS=$((BENCH_SCALE * 100))
+
+psql_bench() {
+    "$PG_BINDIR/psql" -X -q -v ON_ERROR_STOP=1 -h "$BENCH_TMP" \
+        -p "$BENCH_PORT" -d bench "$@"
+}
+
+pgbench_bench() {
+    "$PG_BINDIR/pgbench" -n -h "$BENCH_TMP" -p "$BENCH_PORT" \
+        -D topics="$BENCH_TOPICS" -D posts="$BENCH_POSTS" "$@" bench
+}
+
+cluster_start() {
+    "$PG_BINDIR/initdb" -D "$BENCH_TMP/data" -A trust >/dev/null
+    cat >> "$BENCH_TMP/data/postgresql.conf" <<CONF
+listen_addresses = ''
+unix_socket_directories = '$BENCH_TMP'
+port = $BENCH_PORT
+max_connections = 300
+shared_buffers = 512MB
+max_wal_size = 4GB
+synchronous_commit = off
+dynamic_library_path = '$TOP_DIR:\$libdir'
+shared_preload_libraries = 'cascade_timestamp'
+cascade_timestamp.database = 'bench'
+CONF
+    "$PG_BINDIR/pg_ctl" -D "$BENCH_TMP/data" -l "$BENCH_TMP/server.log" \
+        -w start >/dev/null
+    trap cluster_stop EXIT INT TERM
+    "$PG_BINDIR/createdb" -h "$BENCH_TMP" -p "$BENCH_PORT" bench
+}
+
+cluster_stop() {
+    "$PG_BINDIR/pg_ctl" -D "$BENCH_TMP/data" -m fast -w stop >/dev/null 2>&1
+    rm -rf "$BENCH_TMP"
+}
+
+# load_schema trigger [trigger options]
+#
+# (Re)creates the forum schema with posts cascading to topics, topics to
+# forums and forums to categories through the given trigger variant: `none`,
+# `plpgsql`, `c` or `c_immediate`. The options are appended to the C
+# trigger's arguments, e.g. "'storage=sidecar'".
+load_schema() {
+    psql_bench -v topics="$BENCH_TOPICS" -v posts="$BENCH_POSTS" \
+        -f "$BENCH_DIR/schema.sql"
+    case "$1" in
+        c|c_*)
+            psql_bench -f "$TOP_DIR/cascade_timestamp.sql" ;;
+    esac
+    psql_bench -v extra="${2:+, $2}" -f "$BENCH_DIR/triggers/$1.sql"
+    psql_bench -c "VACUUM ANALYZE"
+}
+
+# pgbench_field output pattern
+#
+# Extracts a number from pgbench's summary, e.g. `tps`.
+pgbench_field() {
+    case "$2" in
+        tps)
+            sed -n 's/^tps = \([0-9.]*\) (\(without initial connection time\|excluding connections establishing\)).*/\1/p' "$1" ;;
+        transactions)
+            sed -n 's/^number of transactions actually processed: \([0-9]*\).*/\1/p' "$1" ;;
+        latency)
+            sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p' "$1" ;;
+    esac
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Memory benchmark for the after-trigger event queue. A row trigger queues
+# one event per source row in backend memory; with the recommended
+# DEFERRABLE INITIALLY DEFERRED trigger that queue only drains at commit.
+# For every transaction size and trigger mode this records the insert and
+# commit times and the backend's own memory, all from
+# pg_backend_memory_contexts (PG14+):
+#
+#     queue_bytes           the AfterTriggerEvents context right before commit
+#     context_bytes         all memory contexts right before commit
+#     commit_context_bytes  all memory contexts right after commit
+#     anon_rss_kb           RssAnon of the backend after commit (Linux only)
+#
+# RSS is the private resident memory rather than VmHWM, which also counts
+# every shared_buffers page the backend touched and so grows with the data
+# read instead of with the queue.
+#
+# Environment (see also lib.sh):
+#     BENCH_ROWS        transaction sizes (10000 100000 1000000 10000000)
+#     BENCH_MODES       trigger modes, name:trigger (below)
+
+set -e
+BENCH_OUTPUT=${BENCH_OUTPUT:-$(pwd)/bench_memory.csv}
+BENCH_SCALE=${BENCH_SCALE:-1000}
+. "$(dirname "$0")/lib.sh"
+
+BENCH_ROWS=${BENCH_ROWS:-10000 100000 1000000 10000000}
+BENCH_MODES=${BENCH_MODES:-"none:none
+plpgsql_deferred:plpgsql
+deferred:c
+immediate:c_immediate"}
+
+cluster_start
+
+echo "mode,rows,insert_ms,commit_ms,queue_bytes,context_bytes,commit_context_bytes,anon_rss_kb" \
+    > "$BENCH_OUTPUT"
+
+for rows in $BENCH_ROWS; do
+    echo "$BENCH_MODES" | while IFS=: read -r name trigger; do
+        [ -n "$name" ] || continue
+
+        load_schema "$trigger"
+        psql_bench -A -t -v topics="$BENCH_TOPICS" -v rows="$rows" \
+            -f "$BENCH_DIR/scripts/memory.sql" > "$BENCH_TMP/memory.out"
+
+        times=$(sed -n 's/^Time: \([0-9.]*\) ms.*/\1/p' "$BENCH_TMP/memory.out" \
+            | paste -s -d, -)
+        memory=$(sed -n 's/^memory,//p' "$BENCH_TMP/memory.out")
+        rss=$(sed -n 's/^rss,//p' "$BENCH_TMP/memory.out")
+
+        echo "$name,$rows,$times,$memory,$rss" >> "$BENCH_OUTPUT"
+        echo "$name $rows rows: $times ms, $memory context bytes"
+    done
+done
+
+echo "results written to $BENCH_OUTPUT"
@@ -0,0 +1,234 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Microbenchmark of the server-independent per-row routines of the trigger
+(cascade_timestamp_core.c), fed with synthetic tuple images, filter values,
+plan caches and keys. Prints one CSV line per case:
+
+    routine,case,ns_per_op,allocs_per_op
+
+Usage: microbench [iterations]
+
+Allocations are counted by interposing malloc() and friends, which is only
+supported with glibc; elsewhere allocs_per_op is empty.
+*/
+
+#include "cascade_timestamp_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long allocs = 0;
+
+void *
+malloc(size_t size){
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size){
+    allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size){
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr){
+    __libc_free(ptr);
+}
+#define ALLOCS()    allocs
+#else
+#define ALLOCS()    0UL
+#endif
+
+/* Keeps the compiler from optimizing the measured calls away */
+static volatile long sink;
+
+typedef struct {
+    uint32_t trigger;
+    void *plan;
+} BenchPlan;
+
+static long iterations = 10000000;
+static struct timespec started;
+static unsigned long allocs_before;
+
+static void
+bench_start(void){
+    allocs_before = ALLOCS();
+    clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+static void
+bench_stop(const char *routine, const char *name){
+    struct timespec stopped;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+    ns = (stopped.tv_sec - started.tv_sec) * 1e9 +
+            (stopped.tv_nsec - started.tv_nsec);
+
+#ifdef __GLIBC__
+    printf("%s,%s,%.2f,%.4f\n", routine, name, ns / iterations,
+            (double) (ALLOCS() - allocs_before) / iterations);
+#else
+    printf("%s,%s,%.2f,\n", routine, name, ns / iterations);
+#endif
+}
+
+/*
+ * Two images of a tuple with `len` bytes from t_bits onwards, identical
+ * unless `differ` is set, in which case the last byte differs.
+ */
+static void
+bench_tuple_images(size_t len, int differ){
+    char *a = malloc(len);
+    char *b = malloc(len);
+    CtTupleImage ia, ib;
+    char name[64];
+    long i;
+
+    for(i = 0; i < (long) len; i++)
+        a[i] = b[i] = (char) (i * 31);
+    if(differ)
+        b[len - 1]++;
+
+    ia.len = ib.len = (uint32_t) (len + 23);
+    ia.natts = ib.natts = 7;
+    ia.infomask = ib.infomask = 0x0802;
+    ia.hoff = ib.hoff = 24;
+    ia.bits = a;
+    ib.bits = b;
+    ia.bits_len = ib.bits_len = len;
+
+    snprintf(name, sizeof(name), "%zu bytes %s", len,
+            differ ? "changed" : "unchanged");
+    bench_start();
+    for(i = 0; i < iterations; i++)
+        sink += ct_tuple_images_equal(&ia, &ib);
+    bench_stop("tuple_images_equal", name);
+
+    free(a);
+    free(b);
+}
+
+static void
+bench_filters(int nfilters){
+    const char *values[8] = {"published", "1", "en", "open", "t", "42", "x", "y"};
+    const char *expected[8] = {"published", "1", "en", "open", "t", "42", "x", "y"};
+    char name[64];
+    long i;
+    int f;
+
+    snprintf(name, sizeof(name), "%d filters", nfilters);
+    bench_start();
+    for(i = 0; i < iterations; i++){
+        for(f = 0; f < nfilters; f++){
+            if(!ct_filter_matches(values[f], expected[f]))
+                break;
+        }
+        sink += f;
+    }
+    bench_stop("filter_matches", name);
+}
+
+/* Looks up the last trigger of a plan cache of `nplans` triggers */
+static void
+bench_find_oid(int nplans){
+    BenchPlan *plans = malloc(nplans * sizeof(BenchPlan));
+    char name[64];
+    long i;
+    int p;
+
+    for(p = 0; p < nplans; p++){
+        plans[p].trigger = 16384 + p;
+        plans[p].plan = NULL;
+    }
+
+    snprintf(name, sizeof(name), "%d plans", nplans);
+    bench_start();
+    for(i = 0; i < iterations; i++)
+        sink += ct_find_oid(plans, sizeof(BenchPlan), nplans,
+                16384 + nplans - 1);
+    bench_stop("find_oid", name);
+
+    free(plans);
+}
+
+static void
+bench_int64_text(int64_t base, const char *name){
+    char buf[CT_INT64_TEXT_LEN];
+    long i;
+
+    bench_start();
+    for(i = 0; i < iterations; i++)
+        sink += ct_int64_text(base + (i & 1023), buf);
+    bench_stop("int64_text", name);
+}
+
+static void
+bench_uuid_text(void){
+    unsigned char uuid[16];
+    char buf[CT_UUID_TEXT_LEN];
+    long i;
+    int b;
+
+    for(b = 0; b < 16; b++)
+        uuid[b] = (unsigned char) (b * 37 + 11);
+
+    bench_start();
+    for(i = 0; i < iterations; i++){
+        uuid[15] = (unsigned char) i;
+        sink += ct_uuid_text(uuid, buf);
+    }
+    bench_stop("uuid_text", "uuid");
+}
+
+int
+main(int argc, char **argv){
+    if(argc > 1)
+        iterations = atol(argv[1]);
+    if(iterations <= 0){
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("routine,case,ns_per_op,allocs_per_op\n");
+
+    bench_tuple_images(64, 0);
+    bench_tuple_images(64, 1);
+    bench_tuple_images(512, 0);
+    bench_tuple_images(512, 1);
+    bench_tuple_images(4096, 0);
+
+    bench_filters(0);
+    bench_filters(1);
+    bench_filters(4);
+
+    bench_find_oid(1);
+    bench_find_oid(8);
+    bench_find_oid(64);
+    bench_find_oid(512);
+
+    bench_int64_text(12345, "5 digits");
+    bench_int64_text(INT64_C(9000000000000000000), "19 digits");
+
+    bench_uuid_text();
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Throughput benchmark: single-row inserts, updates and deletes and bulk
+# INSERT ... SELECT / COPY against the forum schema, with cascade_timestamp,
+# the equivalent PL/pgSQL trigger and without any trigger.
+#
+# Writes one CSV line per run to $BENCH_OUTPUT. overhead_us_per_row is the
+# extra time per source row compared to the run without trigger.
+#
+# Environment (see also lib.sh):
+#     BENCH_CLIENTS     concurrent pgbench clients (1)
+#     BENCH_BULK_ROWS   rows per bulk statement (1000)
+#     BENCH_TRIGGERS    trigger variants to compare (none plpgsql c)
+
+set -e
+. "$(dirname "$0")/lib.sh"
+
+BENCH_CLIENTS=${BENCH_CLIENTS:-1}
+BENCH_BULK_ROWS=${BENCH_BULK_ROWS:-1000}
+BENCH_TRIGGERS=${BENCH_TRIGGERS:-none plpgsql c}
+
+cluster_start
+
+results="$BENCH_TMP/results.csv"
+for trigger in $BENCH_TRIGGERS; do
+    load_schema "$trigger"
+
+    for scenario in insert update delete bulk_insert copy; do
+        case $scenario in
+            bulk_insert|copy) rows=$BENCH_BULK_ROWS ;;
+            *) rows=1 ;;
+        esac
+
+        pgbench_bench -M simple -c "$BENCH_CLIENTS" -j "$BENCH_CLIENTS" \
+            -T "$BENCH_DURATION" -D rows="$rows" \
+            -f "$BENCH_DIR/scripts/$scenario.sql" > "$BENCH_TMP/pgbench.out"
+
+        echo "$scenario,$trigger,$BENCH_CLIENTS,$BENCH_DURATION,$rows,$(pgbench_field "$BENCH_TMP/pgbench.out" transactions),$(pgbench_field "$BENCH_TMP/pgbench.out" tps),$(pgbench_field "$BENCH_TMP/pgbench.out" latency)" \
+            >> "$results"
+        echo "$trigger $scenario: $(pgbench_field "$BENCH_TMP/pgbench.out" tps) tps"
+    done
+done
+
+# Per-row overhead relative to the same scenario without trigger
+awk -F, '
+    BEGIN {
+        print "scenario,trigger,clients,duration_s,rows_per_transaction," \
+            "transactions,tps,latency_avg_ms,rows_per_s,overhead_us_per_row"
+    }
+    { line[NR] = $0; scenario[NR] = $1; trigger[NR] = $2; clients[NR] = $3
+      rows[NR] = $5; tps[NR] = $7
+      if ($2 == "none") baseline[$1] = $7 }
+    END {
+        for (i = 1; i <= NR; i++) {
+            overhead = ""
+            if (baseline[scenario[i]] > 0 && tps[i] > 0)
+                overhead = sprintf("%.2f", (1 / tps[i] - 1 / baseline[scenario[i]]) \
+                    * 1000000 * clients[i] / rows[i])
+            printf "%s,%.1f,%s\n", line[i], tps[i] * rows[i], overhead
+        }
+    }' "$results" > "$BENCH_OUTPUT"
+
+echo "results written to $BENCH_OUTPUT"
@@ -0,0 +1,52 @@
+-- Forum-shaped benchmark schema: category <- forum <- topic <- post. Expects
+-- the psql variables `topics` and `posts`.
+DROP TABLE IF EXISTS post, topic, forum, category CASCADE;
+
+CREATE TABLE category (
+    id serial PRIMARY KEY,
+    name text NOT NULL,
+    updated_at timestamptz NOT NULL DEFAULT now()
+);
+
+CREATE TABLE forum (
+    id serial PRIMARY KEY,
+    category_id integer NOT NULL REFERENCES category,
+    name text NOT NULL,
+    updated_at timestamptz NOT NULL DEFAULT now()
+);
+
+CREATE TABLE topic (
+    id serial PRIMARY KEY,
+    forum_id integer NOT NULL REFERENCES forum,
+    title text NOT NULL,
+    description text NOT NULL,
+    status text NOT NULL DEFAULT 'open',
+    updated_at timestamptz NOT NULL DEFAULT now()
+);
+
+CREATE TABLE post (
+    id bigserial PRIMARY KEY,
+    topic_id integer NOT NULL REFERENCES topic,
+    author text NOT NULL,
+    body text NOT NULL,
+    score integer NOT NULL DEFAULT 0,
+    status text NOT NULL DEFAULT 'published',
+    created_at timestamptz NOT NULL DEFAULT now()
+);
+
+INSERT INTO category (name)
+SELECT 'category ' || i FROM generate_series(1, 10) i;
+
+INSERT INTO forum (category_id, name)
+SELECT 1 + i % 10, 'forum ' || i FROM generate_series(1, 100) i;
+
+-- The description is large enough to get TOASTed
+INSERT INTO topic (forum_id, title, description)
+SELECT 1 + i % 100, 'topic ' || i, repeat(md5(i::text), 100)
+FROM generate_series(1, :topics) i;
+
+INSERT INTO post (topic_id, author, body, score)
+SELECT 1 + i % :topics, 'author ' || i % 1000, repeat('x', 200), i % 10
+FROM generate_series(1, :posts) i;
+
+CREATE INDEX post_topic_id ON post (topic_id, created_at);
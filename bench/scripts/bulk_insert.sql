@@ -0,0 +1,4 @@
+-- INSERT ... SELECT of :rows posts spread over random topics
+INSERT INTO post (topic_id, author, body, score)
+SELECT 1 + (random() * (:topics - 1))::integer, 'bench', repeat('x', 200), 1
+FROM generate_series(1, :rows);
@@ -0,0 +1,3 @@
+-- COPY of :rows posts spread over random topics, generated server side
+COPY post (topic_id, author, body, score) FROM PROGRAM
+    'awk -v n=:rows -v t=:topics ''BEGIN { srand(); for (i = 0; i < n; i++) printf "%d\tbench\tcopied post\t1\n", 1 + int(rand() * t) }''';
@@ -0,0 +1,6 @@
+-- Delete a single post of a random topic
+\set topic random(1, :topics)
+DELETE FROM post WHERE id = (
+    SELECT id FROM post WHERE topic_id = :topic
+    LIMIT 1 FOR UPDATE SKIP LOCKED
+);
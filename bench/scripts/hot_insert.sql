@@ -0,0 +1,4 @@
+-- A single new post in a Zipf-skewed topic
+\set topic random_zipfian(1, :topics, :skew)
+INSERT INTO post (topic_id, author, body, score)
+VALUES (:topic, 'bench', repeat('x', 200), 1);
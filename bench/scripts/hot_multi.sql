@@ -0,0 +1,13 @@
+-- Posts in three Zipf-skewed topics in one transaction; the cascades lock
+-- the topics in arbitrary order, so concurrent clients can deadlock
+\set topic1 random_zipfian(1, :topics, :skew)
+\set topic2 random_zipfian(1, :topics, :skew)
+\set topic3 random_zipfian(1, :topics, :skew)
+BEGIN;
+INSERT INTO post (topic_id, author, body, score)
+VALUES (:topic1, 'bench', repeat('x', 200), 1);
+INSERT INTO post (topic_id, author, body, score)
+VALUES (:topic2, 'bench', repeat('x', 200), 1);
+INSERT INTO post (topic_id, author, body, score)
+VALUES (:topic3, 'bench', repeat('x', 200), 1);
+COMMIT;
@@ -0,0 +1,4 @@
+-- A single new post
+\set topic random(1, :topics)
+INSERT INTO post (topic_id, author, body, score)
+VALUES (:topic, 'bench', repeat('x', 200), 1);
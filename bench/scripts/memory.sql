@@ -0,0 +1,25 @@
+-- One transaction inserting :rows posts. Reports the statement and commit
+-- times and the backend's own memory from pg_backend_memory_contexts: the
+-- queued after-trigger events and all contexts right before commit, and all
+-- contexts again right after it. RssAnon is the private resident memory of
+-- the backend after commit; unlike VmHWM it leaves out the shared_buffers
+-- pages the backend touched.
+BEGIN;
+\timing on
+INSERT INTO post (topic_id, author, body, score)
+SELECT 1 + i % :topics, 'bench', 'memory', 1
+FROM generate_series(1, :rows) i;
+\timing off
+SELECT coalesce(sum(total_bytes) FILTER (WHERE name = 'AfterTriggerEvents'), 0)
+        AS queue_bytes,
+    sum(total_bytes) AS context_bytes,
+    pg_backend_pid() AS pid
+FROM pg_backend_memory_contexts \gset
+\timing on
+COMMIT;
+\timing off
+SELECT sum(total_bytes) AS commit_context_bytes
+FROM pg_backend_memory_contexts \gset
+\echo memory,:queue_bytes,:context_bytes,:commit_context_bytes
+\setenv BENCH_PID :pid
+\! awk '/^RssAnon/ { print "rss," $2 }' /proc/$BENCH_PID/status
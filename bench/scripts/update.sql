@@ -0,0 +1,3 @@
+-- Edit a single post
+\set post random(1, :posts)
+UPDATE post SET score = score + 1 WHERE id = :post;
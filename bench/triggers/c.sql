@@ -0,0 +1,13 @@
+-- The cascade_timestamp trigger. `extra` holds additional trigger arguments
+-- (with a leading comma) or is empty.
+CREATE CONSTRAINT TRIGGER post_cascade AFTER INSERT OR UPDATE OR DELETE ON post
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(topic, updated_at, id, topic_id :extra);
+
+CREATE CONSTRAINT TRIGGER topic_cascade AFTER INSERT OR UPDATE OR DELETE ON topic
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(forum, updated_at, id, forum_id :extra);
+
+CREATE CONSTRAINT TRIGGER forum_cascade AFTER INSERT OR UPDATE OR DELETE ON forum
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(category, updated_at, id, category_id :extra);
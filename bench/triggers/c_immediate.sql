@@ -0,0 +1,13 @@
+-- cascade_timestamp as a plain (not deferred) AFTER ROW trigger, so the
+-- queued events are fired at the end of every statement
+CREATE TRIGGER post_cascade AFTER INSERT OR UPDATE OR DELETE ON post
+FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(topic, updated_at, id, topic_id :extra);
+
+CREATE TRIGGER topic_cascade AFTER INSERT OR UPDATE OR DELETE ON topic
+FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(forum, updated_at, id, forum_id :extra);
+
+CREATE TRIGGER forum_cascade AFTER INSERT OR UPDATE OR DELETE ON forum
+FOR EACH ROW
+EXECUTE PROCEDURE cascade_timestamp(category, updated_at, id, category_id :extra);
@@ -0,0 +1,2 @@
+-- Baseline without any cascading triggers
+SELECT 1;
@@ -0,0 +1,35 @@
+-- The PL/pgSQL trigger people write instead of cascade_timestamp: skip
+-- no-op updates, then touch the destination through the old row for updates
+-- and deletes and the new row for inserts. `extra` is ignored.
+CREATE OR REPLACE FUNCTION bench_cascade() RETURNS trigger AS $$
+DECLARE
+    source record;
+BEGIN
+    IF TG_OP = 'UPDATE' AND NEW IS NOT DISTINCT FROM OLD THEN
+        RETURN NULL;
+    ELSIF TG_OP = 'INSERT' THEN
+        source := NEW;
+    ELSE
+        source := OLD;
+    END IF;
+
+    CASE TG_TABLE_NAME
+        WHEN 'post' THEN
+            UPDATE topic SET updated_at = now() WHERE id = source.topic_id;
+        WHEN 'topic' THEN
+            UPDATE forum SET updated_at = now() WHERE id = source.forum_id;
+        WHEN 'forum' THEN
+            UPDATE category SET updated_at = now() WHERE id = source.category_id;
+    END CASE;
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE CONSTRAINT TRIGGER post_cascade AFTER INSERT OR UPDATE OR DELETE ON post
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW EXECUTE PROCEDURE bench_cascade();
+
+CREATE CONSTRAINT TRIGGER topic_cascade AFTER INSERT OR UPDATE OR DELETE ON topic
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW EXECUTE PROCEDURE bench_cascade();
+
+CREATE CONSTRAINT TRIGGER forum_cascade AFTER INSERT OR UPDATE OR DELETE ON forum
+DEFERRABLE INITIALLY DEFERRED FOR EACH ROW EXECUTE PROCEDURE bench_cascade();
@@ -0,0 +1,100 @@
+#!/bin/sh
+#
+# Write amplification benchmark: runs a fixed number of post inserts and
+# updates without trigger, with the PL/pgSQL trigger and with
+# cascade_timestamp in each of its storage modes, and records the WAL
+# written, the dead tuples and HOT ratio of the topic table and how much the
+# topic table and its indexes grew.
+#
+# wal_bytes_per_row is the WAL per source row on top of the run without
+# trigger. Autovacuum is disabled on the benchmark tables so the dead tuples
+# stay countable.
+#
+# Environment (see also lib.sh):
+#     BENCH_TRANSACTIONS    transactions per client and script (20000)
+#     BENCH_CLIENTS         concurrent pgbench clients (4)
+#     BENCH_VARIANTS        variants to run, name:trigger:options (below)
+
+set -e
+BENCH_OUTPUT=${BENCH_OUTPUT:-$(pwd)/bench_wal.csv}
+. "$(dirname "$0")/lib.sh"
+
+BENCH_TRANSACTIONS=${BENCH_TRANSACTIONS:-20000}
+BENCH_CLIENTS=${BENCH_CLIENTS:-4}
+BENCH_VARIANTS=${BENCH_VARIANTS:-"none:none:
+plpgsql:plpgsql:
+update:c:
+sidecar:c:'storage=sidecar'
+shmem:c:'storage=shmem'
+lazy:c:'lazy=created_at'
+log:c:'log=on'
+notify:c:'notify=bench'"}
+
+measure() {
+    psql_bench -A -t -F, -c "
+        SELECT pg_current_wal_lsn() - '0/0'::pg_lsn,
+            s.n_tup_upd, s.n_tup_hot_upd, s.n_dead_tup,
+            pg_relation_size('topic'), pg_indexes_size('topic'),
+            coalesce(pg_total_relation_size(
+                to_regclass('topic_cascade_timestamp')), 0)
+        FROM pg_stat_user_tables s
+        WHERE s.relid = 'topic'::regclass"
+}
+
+cluster_start
+
+results="$BENCH_TMP/results.csv"
+echo "$BENCH_VARIANTS" | while IFS=: read -r name trigger options; do
+    [ -n "$name" ] || continue
+
+    load_schema "$trigger" "$options"
+    if [ "$name" = "sidecar" ]; then
+        psql_bench -c "
+            SELECT cascade_timestamp_sidecar(t, 'updated_at', 'id')
+            FROM unnest('{topic,forum,category}'::regclass[]) t"
+    fi
+    if [ "$name" = "log" ]; then
+        psql_bench -c "TRUNCATE cascade_timestamp_log"
+    fi
+    psql_bench -c "
+        ALTER TABLE post SET (autovacuum_enabled = false);
+        ALTER TABLE topic SET (autovacuum_enabled = false);
+        CHECKPOINT"
+
+    before=$(measure)
+    for scenario in insert update; do
+        pgbench_bench -M prepared -c "$BENCH_CLIENTS" -j "$BENCH_CLIENTS" \
+            -t "$BENCH_TRANSACTIONS" -f "$BENCH_DIR/scripts/$scenario.sql" \
+            > /dev/null
+    done
+
+    # Give the statistics (and the shmem write-back worker) time to flush
+    sleep 2
+    after=$(measure)
+
+    echo "$name,$before,$after" >> "$results"
+    echo "$name done"
+done
+
+awk -F, -v rows=$((BENCH_TRANSACTIONS * BENCH_CLIENTS * 2)) '
+    BEGIN {
+        print "variant,source_rows,wal_bytes,wal_bytes_per_row," \
+            "topic_updates,topic_hot_updates,topic_hot_ratio,topic_dead_tuples," \
+            "topic_heap_growth_bytes,topic_index_growth_bytes,sidecar_bytes"
+    }
+    {
+        # fields 2-8 before, 9-15 after
+        wal[NR] = $9 - $2; name[NR] = $1
+        if ($1 == "none") baseline = wal[NR]
+        upd = $10 - $3; hot = $11 - $4
+        line[NR] = sprintf("%d,%d,%s,%d,%d,%d,%d", upd, hot,
+            upd > 0 ? sprintf("%.3f", hot / upd) : "", $12 - $5, $13 - $6,
+            $14 - $7, $15)
+    }
+    END {
+        for (i = 1; i <= NR; i++)
+            printf "%s,%d,%d,%.1f,%s\n", name[i], rows, wal[i],
+                (wal[i] - baseline) / rows, line[i]
+    }' "$results" > "$BENCH_OUTPUT"
+
+echo "results written to $BENCH_OUTPUT"
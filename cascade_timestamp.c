@@ -16,7 +16,30 @@ Usage:
 --     destination_timestamp_column,
 --     destination_key (primary key),
 --     source_key (foreign key),
+--     [source_column, value, ...],
+--     ['option=value', ...]
 -- )
+--
+-- Supported options:
+--     storage=update    update the destination row itself (default)
+--     storage=sidecar   upsert (key, timestamp) into a narrow sidecar table
+--     storage=shmem     store the timestamp in the shared-memory map, see
+--                       cascade_timestamp_shmem.c
+--     storage=inplace   overwrite the timestamp in the existing row, not
+--                       transactional, see cascade_timestamp_direct.c
+--     lazy=column       only invalidate the memoized timestamp, readers
+--                       compute max(column) of the source rows on demand
+--     log=on            also append (destination, key, txid) to
+--                       cascade_timestamp_log once per transaction
+--     notify=channel    also NOTIFY the channel with the deduplicated keys
+--                       when the transaction commits
+--     sidecar=table     sidecar table, defaults to <destination>_cascade_timestamp
+--     fastpath=on       update the destination through its primary key
+--                       index instead of SPI when possible
+--     where=expression  only cascade rows for which the SQL expression over
+--                       the columns of the row is true
+--     destination_where=expression
+--                       only update destination rows for which it is true
 DROP TRIGGER IF EXISTS post_update_trigger ON post;
 
 CREATE CONSTRAINT TRIGGER post_update_trigger
@@ -27,61 +50,363 @@ EXECUTE PROCEDURE cascade_timestamp(topic, updated_at, id, topic_id);
 */
 
 #include "postgres.h"
-#include "access/htup.h"
+#include "cascade_timestamp.h"
+#include "cascade_timestamp_core.h"
+#include "cascade_timestamp_probes.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
 #include "catalog/pg_type.h"
+#include "commands/dbcommands.h"
 #include "commands/trigger.h"
 #include "executor/spi.h"
+#include "executor/tuptable.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/uuid.h"
 #include <ctype.h>
 
-/* Since Postgres 9.3 we need the `htup_details.h` include */
-#ifndef HeapTupleHeaderGetOid
-#include "access/htup_details.h"
-#endif
-
-/* Since Postgres 9.2 we need the `rel.h` include */
-#ifndef RelationData
-#include "utils/rel.h"
-#endif
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
 extern Datum cascade_timestamp(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_plan_cache(PG_FUNCTION_ARGS);
+
+/* Where the cascaded timestamp gets written */
+#define CT_STORAGE_UPDATE   0
+#define CT_STORAGE_SIDECAR  1
+#define CT_STORAGE_SHMEM    2
+#define CT_STORAGE_LAZY     3
+#define CT_STORAGE_INPLACE  4
+
+/* How the key is rendered, chosen once per trigger from its type */
+#define CT_KEY_GENERIC      0   /* through the output function */
+#define CT_KEY_INT2         1
+#define CT_KEY_INT4         2
+#define CT_KEY_INT8         3
+#define CT_KEY_UUID         4
+
+/* How a filter compares the column, chosen once per trigger from its type */
+#define CT_FILTER_OUTPUT    0   /* the text of the column, allocates */
+#define CT_FILTER_DATUM     1   /* pass-by-value types, the Datum itself */
+#define CT_FILTER_TEXT      2   /* text and varchar, the bytes in place */
+
+/* A (column, value) filter pair of the trigger arguments */
+typedef struct {
+    int arg;                /* index of the column in tgargs */
+    AttrNumber attnum;      /* checked on every row, like the key */
+    Oid typid;
+    int kind;
+    Datum value;            /* the value parsed, for CT_FILTER_DATUM */
+    int len;                /* strlen() of the value, for CT_FILTER_TEXT */
+    Oid output;             /* for CT_FILTER_OUTPUT */
+} CtFilter;
 
 typedef struct {
+    Oid trigger;    /* first, for ct_find_oid() */
+    Oid relid;      /* of the source table */
+    int nargs;      /* the arguments the plan was configured from */
+    char **args;
+    bool stale;     /* the trigger may have been replaced since */
     char *ident;
+    MemoryContext context;  /* holds the plan and everything it points to */
     SPIPlanPtr plan;
+    int busy;       /* invocations running with this plan */
+    uint64 lastused;
+    bool configured;
+    int storage;
+    char *sidecar;
+    Oid destination;
+    bool log;
+    char *notify;
+    bool fastpath;
+    CtDirect direct;    /* destination of fastpath=on and storage=inplace */
+    CtStats *stats;
+    bool mapped;    /* destination is registered in the shared-memory map */
+    AttrNumber keyattnum;   /* source key column, checked on every row */
+    Oid keytype;
+    int keykind;
+    Oid keyoutput;          /* only for CT_KEY_GENERIC */
+    char keybuf[CT_UUID_TEXT_LEN];      /* text of integer and uuid keys */
+    int nfilters;
+    CtFilter *filters;
+    char *where;    /* where=, compiled into predicate on the first row */
+    char *destination_where;
+    CtPredicate *predicate;
+    bool typed;     /* no filter has to go through the output function */
+    bool hot;       /* the current row needs nothing set up */
 } EPlan;
 
-static EPlan *FPlans = NULL;
+/*
+ * The plans live in their own child contexts of "cascade_timestamp plans",
+ * so that they show up in pg_backend_memory_contexts and an evicted plan is
+ * a single MemoryContextDelete(). The index only points to them; the plans
+ * themselves never move, nested invocations may still be using them.
+ */
+typedef struct {
+    Oid trigger;    /* first, for ct_find_oid() */
+    EPlan *plan;
+} EPlanEntry;
+
+static MemoryContext PlanContext = NULL;
+static EPlanEntry *FPlans = NULL;
 static int nFPlans = 0;
+static int maxFPlans = 0;
+static uint64 PlanClock = 0;
+static int BusyPlans = 0;
+
+/* cascade_timestamp.max_plans, 0 for no limit */
+static int MaxPlans = 0;
+
+/* INSERT into the delta log, shared by all triggers */
+static SPIPlanPtr LogPlan = NULL;
+
+#ifdef USE_ASSERT_CHECKING
+/*
+ * Debug builds run the outermost invocation in an empty context of its
+ * own, and count the invocations of warmed up plans that allocated in it.
+ * SPI and the executor allocate in contexts of their own, which are not
+ * counted.
+ */
+static MemoryContext RowContext = NULL;
+static int RowDepth = 0;
+static int64 HotAllocations = 0;
+#endif
+
+static Datum cascade_row_checked(FunctionCallInfo fcinfo, EPlan **used);
+static Datum cascade_row(FunctionCallInfo fcinfo, EPlan **used);
+static EPlan *find_plan(Trigger *trigger, Relation rel);
+static bool evict_plan(void);
+static void plans_xact_callback(XactEvent event, void *arg);
+static void plans_relcache_callback(Datum arg, Oid relid);
+static bool same_args(EPlan *plan, Trigger *trigger);
+static void free_plan(int i);
+static bool slots_equal(TupleTableSlot *newslot, TupleTableSlot *oldslot,
+        TupleDesc tupdesc);
+static void tuple_image(HeapTuple tuple, CtTupleImage *image);
+static void configure_plan(EPlan *plan, Trigger *trigger);
+static void set_option(EPlan *plan, const char *name, int namelen,
+        const char *value);
+static bool cascade_to_map(EPlan *plan, char **args, Oid keytype,
+        Datum kval);
+static bool filter_matches(EPlan *plan, CtFilter *filter,
+        TupleTableSlot *slot, char **args, const char *relname);
+static void resolve_filter(EPlan *plan, CtFilter *filter, TupleDesc tupdesc,
+        char **args, const char *relname);
+static void resolve_key(EPlan *plan, TupleDesc tupdesc, const char *column,
+        const char *relname);
+static char *key_text(EPlan *plan, Datum kval);
+static void cascade_to_log(EPlan *plan, Datum kval);
+static void log_slow_cascade(EPlan *plan, Trigger *trigger, Datum kval,
+        double elapsed);
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static void ct_shmem_request(void);
+static void ct_shmem_startup(void);
 
-static EPlan *find_plan(char *ident, EPlan **eplan, int *nplans);
 PG_FUNCTION_INFO_V1(cascade_timestamp)
 ;
+PG_FUNCTION_INFO_V1(cascade_timestamp_plan_cache);
+
+void
+_PG_init(void){
+    DefineCustomIntVariable("cascade_timestamp.max_plans",
+            "Number of trigger plans cached per backend, 0 for no limit.",
+            "The least recently used plan is evicted to make room.",
+            &MaxPlans,
+            0, 0, INT_MAX,
+            PGC_USERSET,
+            0,
+            NULL, NULL, NULL);
+    RegisterXactCallback(plans_xact_callback, NULL);
+    CacheRegisterRelcacheCallback(plans_relcache_callback, (Datum) 0);
+
+    ct_activity_init();
+    ct_direct_init();
+    ct_map_init();
+    ct_predicate_init();
+    ct_stats_init();
+    ct_summary_init();
+    ct_top_init();
+    ct_xact_init();
+
+    /* Shared memory can only be reserved when preloaded */
+    if(!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = ct_shmem_request;
+#else
+    ct_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = ct_shmem_startup;
+}
+
+static void
+ct_shmem_request(void){
+#if PG_VERSION_NUM >= 150000
+    if(prev_shmem_request_hook)
+        prev_shmem_request_hook();
+#endif
+    ct_activity_shmem_request();
+    ct_map_shmem_request();
+    ct_stats_shmem_request();
+    ct_top_shmem_request();
+}
+
+static void
+ct_shmem_startup(void){
+    if(prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    ct_activity_shmem_startup();
+    ct_map_shmem_startup();
+    ct_stats_shmem_startup();
+    ct_top_shmem_startup();
+    LWLockRelease(AddinShmemInitLock);
+}
 
 Datum cascade_timestamp(PG_FUNCTION_ARGS){
+    EPlan *plan = NULL;
+    instr_time start, duration;
+    Datum result;
+    bool summary = (ct_statement_summary != 0);
+
+    if(!ct_track_timing && !summary){
+        result = cascade_row_checked(fcinfo, &plan);
+        if(plan != NULL){
+            plan->busy--;
+            BusyPlans--;
+        }
+        return result;
+    }
+
+    INSTR_TIME_SET_CURRENT(start);
+    if(summary){
+        /* Statements run by the trigger must not report the summary */
+        ct_summary_enter();
+        PG_TRY();
+        {
+            result = cascade_row_checked(fcinfo, &plan);
+        }
+        PG_CATCH();
+        {
+            ct_summary_leave();
+            PG_RE_THROW();
+        }
+        PG_END_TRY();
+        ct_summary_leave();
+    }else{
+        result = cascade_row_checked(fcinfo, &plan);
+    }
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start);
+
+    if(plan == NULL)
+        return result;
+
+    plan->busy--;
+    BusyPlans--;
+    if(ct_track_timing)
+        ct_stats_time(plan->stats, CT_TIME_TOTAL, duration);
+    if(summary)
+        ct_summary_time(duration);
+
+    return result;
+}
+
+/*
+ * cascade_row(). Once a plan is warmed up, with typed filters and a key
+ * type of its own, the trigger itself should not allocate memory for an
+ * invocation; debug builds check that for what is allocated in the current
+ * context, see hot_allocations of cascade_timestamp_plan_cache(). The
+ * UPDATE run through SPI, or the fast path, allocate in their own contexts
+ * as usual and are not checked. Nested invocations are not checked.
+ */
+static Datum
+cascade_row_checked(FunctionCallInfo fcinfo, EPlan **used){
+#ifdef USE_ASSERT_CHECKING
+    MemoryContext oldcontext;
+    Datum result;
+
+    if(RowDepth > 0)
+        return cascade_row(fcinfo, used);
+
+    if(RowContext == NULL){
+        RowContext = AllocSetContextCreate(TopMemoryContext,
+                "cascade_timestamp row", ALLOCSET_SMALL_SIZES);
+    }
+    MemoryContextReset(RowContext);
+
+    oldcontext = MemoryContextSwitchTo(RowContext);
+    RowDepth++;
+    PG_TRY();
+    {
+        result = cascade_row(fcinfo, used);
+    }
+    PG_CATCH();
+    {
+        RowDepth--;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    RowDepth--;
+    MemoryContextSwitchTo(oldcontext);
+
+    if(*used != NULL && (*used)->hot && !MemoryContextIsEmpty(RowContext))
+        HotAllocations++;
+    return result;
+#else
+    return cascade_row(fcinfo, used);
+#endif
+}
+
+/*
+ * The trigger proper; sets *used once the plan of the trigger is known. The
+ * plan is marked busy so it is not evicted by nested invocations, the
+ * caller releases it and accounts the invocation time to its statistics.
+ */
+static Datum
+cascade_row(FunctionCallInfo fcinfo, EPlan **used){
     TriggerData *trigdata = (TriggerData *)fcinfo->context;
-    HeapTuple newtuple = trigdata->tg_newtuple, oldtuple =
-            trigdata->tg_trigtuple, rettuple = NULL;
-    HeapTupleHeader newheader, oldheader;
+    HeapTuple rettuple = NULL;
+    TupleTableSlot *slot = trigdata->tg_trigslot;
     Trigger *trigger = trigdata->tg_trigger;
     Datum kval;
-    int fnumber;
     char **args;
-    char *relname;
+    const char *relname;
     Oid argtype;
     bool update;
     bool isnull;
     int ret;
-    char ident[2 * NAMEDATALEN];
+    uint64 processed;
+    uint32 keyhash = 0;
     Relation rel;
     TupleDesc tupdesc;
     EPlan *plan;
+    CtStats *stats;
+    instr_time start, duration;
+    bool timed;
     char sql[1024];
-    char *newval;
+    int len;
     int i;
 
     /* make sure it's called as a trigger */
@@ -106,108 +431,201 @@ Datum cascade_timestamp(PG_FUNCTION_ARGS){
     }
 
     /* and that it's called with the right arguments */
-    if(trigger->tgnargs < 3){
+    if(trigger->tgnargs < 4){
         elog(ERROR, "cascade_timestamp: A destination table, timestamp column, primary key column and a foreign key column were expected, got %d arguments", trigger->tgnargs);
         SPI_finish();
         return PointerGetDatum(NULL);
     }
 
+    TRACE_CASCADE_TIMESTAMP_TRIGGER_START(trigger->tgoid);
+
     rettuple = trigdata->tg_trigtuple;
     update = true;
 
-    if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event)){
-        newheader = newtuple->t_data;
-        oldheader = oldtuple->t_data;
-
-        /* copy the OID just in case it changed somehow */
-        if (trigdata->tg_relation->rd_rel->relhasoids &&
-                !OidIsValid(HeapTupleHeaderGetOid(newheader))){
-            HeapTupleHeaderSetOid(newheader, HeapTupleHeaderGetOid(oldheader));
-        }
-
-        /* if the tuple payload is the same ... */
-        if (newtuple->t_len == oldtuple->t_len &&
-                newheader->t_hoff == oldheader->t_hoff &&
-                (HeapTupleHeaderGetNatts(newheader) ==
-                        HeapTupleHeaderGetNatts(oldheader)) &&
-                ((newheader->t_infomask & ~HEAP_XACT_MASK) ==
-                        (oldheader->t_infomask & ~HEAP_XACT_MASK)) &&
-                memcmp(((char *) newheader) + offsetof(HeapTupleHeaderData, t_bits),
-                        ((char *) oldheader) + offsetof(HeapTupleHeaderData, t_bits),
-                        newtuple->t_len - offsetof(HeapTupleHeaderData, t_bits)) == 0){
-
-            update = false;
-        } else{
-            update = true;
-        }
-    }
-
     rel = trigdata->tg_relation;
-    relname = SPI_getrelname(rel);
+    relname = RelationGetRelationName(rel);
     args = trigger->tgargs;
     tupdesc = rel->rd_att;
 
-    /* Make sure the foreign key actually exists and has a value */
-    for(i=4; i<trigger->tgnargs; i+=2){
-        fnumber = SPI_fnumber(tupdesc, args[i]);
-        if (fnumber < 0){
-            elog(ERROR, "\"%s\" has no attribute \"%s\"",
-                    relname, args[3]);
+    /* The plans are cached per trigger, so per trigger and table */
+    plan = find_plan(trigger, rel);
+    plan->busy++;
+    BusyPlans++;
+    *used = plan;
+
+    /*
+     * Once the key was resolved all filters were too, so it is only the
+     * destination statement that can still be missing.
+     */
+    plan->hot = plan->configured && plan->keyattnum != InvalidAttrNumber &&
+            plan->typed && plan->keykind != CT_KEY_GENERIC &&
+            (plan->where == NULL || plan->predicate != NULL) &&
+            (plan->plan != NULL || plan->storage == CT_STORAGE_SHMEM ||
+            plan->storage == CT_STORAGE_LAZY);
+    if(!plan->configured)
+        configure_plan(plan, trigger);
+
+    stats = plan->stats;
+    ct_stats_add(stats, CT_STAT_INVOCATIONS, 1);
+
+    if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event)){
+        /* if the row is the same there is nothing to cascade */
+        if (slots_equal(trigdata->tg_newslot, slot, tupdesc)){
+            ct_stats_add(stats, CT_STAT_NOOP, 1);
+            TRACE_CASCADE_TIMESTAMP_TRIGGER_NOOP(trigger->tgoid);
+            return PointerGetDatum(rettuple);
         }
+    }
 
-        newval = SPI_getvalue(rettuple, tupdesc, fnumber);
-        if(newval != NULL && strcmp(newval, args[i+1]) != 0){
+    /* Only cascade if all of the filter columns match */
+    for(i=0; i<plan->nfilters; i++){
+        if(!filter_matches(plan, &plan->filters[i], slot, args, relname)){
             update = false;
             break;
         }
     }
 
-    /* No value for the foreign key */
+    /* Nested invocations may still be evaluating a stale predicate */
+    if(update && plan->where != NULL){
+        if(plan->predicate != NULL && plan->busy == 1 &&
+                ct_predicate_stale(plan->predicate)){
+            ct_predicate_free(plan->predicate);
+            plan->predicate = NULL;
+        }
+        if(plan->predicate == NULL){
+            plan->predicate = ct_predicate_compile(plan->context, rel,
+                    plan->where);
+        }
+        update = ct_predicate_matches(plan->predicate, slot);
+    }
+
     if(!update){
-        SPI_finish();
+        ct_stats_add(stats, CT_STAT_FILTERED, 1);
+        TRACE_CASCADE_TIMESTAMP_TRIGGER_FILTERED(trigger->tgoid);
         return PointerGetDatum(rettuple);
     }
 
-    /* Connect to SPI manager */
-    if ((ret = SPI_connect()) < 0){
-        /* internal error */
-        elog(ERROR, "cascade_timestamp: SPI_connect returned %d", ret);
+    /* Make sure the foreign key actually exists and has a value */
+    resolve_key(plan, tupdesc, args[3], relname);
+    kval = slot_getattr(slot, plan->keyattnum, &isnull);
+    if (isnull){
+        ct_stats_add(stats, CT_STAT_NULL_KEYS, 1);
+        return PointerGetDatum(rettuple);
     }
 
-    /*
-     * Construct ident string as TriggerName $ TriggeredRelationId and try to
-     * find prepared execution plan(s).
-     */
-    snprintf(ident, sizeof(ident), "%s$%u", trigger->tgname, rel->rd_id);
-    plan = find_plan(ident, &FPlans, &nFPlans);
+    if(ct_statement_summary != 0){
+        ct_summary_key(plan->destination,
+                key_text(plan, kval));
+    }
 
-    fnumber = SPI_fnumber(tupdesc, args[2]);
-    if (fnumber < 0){
-        elog(ERROR, "\"%s\" has no attribute \"%s\"",
-                relname, args[2]);
+    if(ct_top_available()){
+        ct_top_count(plan->destination,
+                key_text(plan, kval));
     }
 
-    kval = SPI_getbinval(rettuple, tupdesc, fnumber, &isnull);
+    if(plan->log)
+        cascade_to_log(plan, kval);
 
+    if(plan->notify != NULL){
+        ct_xact_notify(plan->destination, plan->notify,
+                key_text(plan, kval));
+    }
+
+    /* Readers compute the timestamp themselves, just forget the old one */
+    if(plan->storage == CT_STORAGE_LAZY){
+        ct_xact_invalidate(plan->destination,
+                key_text(plan, kval));
+        return PointerGetDatum(rettuple);
+    }
+
+    /* The shared-memory map falls back to updating when it is full */
+    if(plan->storage == CT_STORAGE_SHMEM &&
+            cascade_to_map(plan, args, plan->keytype, kval)){
+        return PointerGetDatum(rettuple);
+    }
+
+    /* Also prepared for fastpath=on, which falls back to it */
     if (plan->plan == NULL){
-        if (isnull)
-        {
-            SPI_finish();
-            return PointerGetDatum(rettuple);
+        TRACE_CASCADE_TIMESTAMP_PLAN_MISS(trigger->tgoid);
+
+        /* Connect to SPI manager */
+        if ((ret = SPI_connect()) < 0){
+            /* internal error */
+            elog(ERROR, "cascade_timestamp: SPI_connect returned %d", ret);
         }
 
         /* Get typeId of column */
-        argtype = SPI_gettypeid(tupdesc, fnumber);
+        argtype = plan->keytype;
 
-        snprintf(
-                sql,
-                sizeof(sql),
-                "UPDATE %s SET %s = NOW() WHERE %s = $1",
-                args[0],
-                args[1],
-                args[2]
-        );
+        if(plan->storage == CT_STORAGE_SIDECAR){
+            /*
+             * Only the narrow sidecar row is rewritten, the destination row
+             * (and its TOASTed columns) is left alone.
+             */
+            len = snprintf(
+                    sql,
+                    sizeof(sql),
+                    "INSERT INTO %s (%s, %s) VALUES ($1, NOW()) "
+                    "ON CONFLICT (%s) DO UPDATE SET %s = EXCLUDED.%s",
+                    plan->sidecar,
+                    args[2],
+                    args[1],
+                    args[2],
+                    args[1],
+                    args[1]
+            );
+        }else{
+            len = snprintf(
+                    sql,
+                    sizeof(sql),
+                    "UPDATE %s SET %s = NOW() WHERE %s = $1",
+                    args[0],
+                    args[1],
+                    args[2]
+            );
+        }
+
+        /*
+         * Parents that do not qualify are neither locked nor written. The
+         * sidecar only upserts for a destination row that qualifies, which
+         * is read without locking it.
+         */
+        if(plan->destination_where != NULL &&
+                plan->storage == CT_STORAGE_SIDECAR){
+            len = snprintf(
+                    sql,
+                    sizeof(sql),
+                    "INSERT INTO %s (%s, %s) SELECT $1, NOW() FROM %s "
+                    "WHERE %s = $1 AND (%s) "
+                    "ON CONFLICT (%s) DO UPDATE SET %s = EXCLUDED.%s",
+                    plan->sidecar,
+                    args[2],
+                    args[1],
+                    args[0],
+                    args[2],
+                    plan->destination_where,
+                    args[2],
+                    args[1],
+                    args[1]
+            );
+        }else if(plan->destination_where != NULL){
+            len = snprintf(
+                    sql,
+                    sizeof(sql),
+                    "UPDATE %s SET %s = NOW() WHERE %s = $1 AND (%s)",
+                    args[0],
+                    args[1],
+                    args[2],
+                    plan->destination_where
+            );
+        }
+
+        if(len >= (int) sizeof(sql)){
+            elog(ERROR, "cascade_timestamp: the destination statement of trigger \"%s\" is too long",
+                    trigger->tgname);
+        }
 
+        ct_stats_add(stats, CT_STAT_PLANS, 1);
         plan->plan = SPI_prepare(sql, 1, &argtype);
         if(plan->plan == NULL){
             /* internal error */
@@ -224,41 +642,715 @@ Datum cascade_timestamp(PG_FUNCTION_ARGS){
             /* internal error */
             elog(ERROR, "cascade_timestamp: SPI_saveplan returned %d", SPI_result);
         }
+        SPI_finish();
     }
 
-    ret = SPI_execp(plan->plan, &kval, NULL, 1);
-    if (ret < 0){
-        elog(ERROR, "SPI_execp returned %d", ret);
+    ct_activity_start(trigger->tgoid, plan->destination,
+            ct_activity_available() ?
+            key_text(plan, kval) : NULL);
+    if(TRACE_CASCADE_TIMESTAMP_UPDATE_START_ENABLED() ||
+            TRACE_CASCADE_TIMESTAMP_UPDATE_DONE_ENABLED())
+        keyhash = CT_KEY_HASH(key_text(plan, kval));
+    TRACE_CASCADE_TIMESTAMP_UPDATE_START(trigger->tgoid, keyhash);
+
+    /* Includes waiting for the destination row lock */
+    timed = ct_track_timing || ct_log_min_duration >= 0;
+    if(timed)
+        INSTR_TIME_SET_CURRENT(start);
+    if(!plan->fastpath || !ct_direct_update(&plan->direct, plan->keytype,
+                kval, &processed)){
+        if ((ret = SPI_connect()) < 0){
+            /* internal error */
+            elog(ERROR, "cascade_timestamp: SPI_connect returned %d", ret);
+        }
+
+        ret = SPI_execp(plan->plan, &kval, NULL, 1);
+        if (ret < 0){
+            elog(ERROR, "SPI_execp returned %d", ret);
+        }
+
+        processed = SPI_processed;
+        SPI_finish();
     }
+    ct_activity_end();
+
+    if(timed){
+        INSTR_TIME_SET_CURRENT(duration);
+        INSTR_TIME_SUBTRACT(duration, start);
+        if(ct_track_timing)
+            ct_stats_time(stats, CT_TIME_STATEMENT, duration);
+        if(ct_log_min_duration >= 0 &&
+                INSTR_TIME_GET_MILLISEC(duration) >= ct_log_min_duration){
+            log_slow_cascade(plan, trigger, kval,
+                    INSTR_TIME_GET_MILLISEC(duration));
+        }
+    }
+    TRACE_CASCADE_TIMESTAMP_UPDATE_DONE(trigger->tgoid, keyhash, processed);
+
+    ct_stats_add(stats, CT_STAT_UPDATES, 1);
+    ct_stats_add(stats, CT_STAT_ROWS, processed);
+    if(processed == 0)
+        ct_stats_add(stats, CT_STAT_MISSING, 1);
 
-    pfree(relname);
-    SPI_finish();
     return PointerGetDatum(rettuple);
 }
 
 static EPlan *
-find_plan(char *ident, EPlan **eplan, int *nplans){
+find_plan(Trigger *trigger, Relation rel){
+    MemoryContext plancontext, oldcontext;
     EPlan *newp;
     int i;
 
-    if(*nplans > 0){
-        for(i = 0;i < *nplans;i++){
-            if(strcmp((*eplan)[i].ident, ident) == 0)
-                break;
+    i = ct_find_oid(FPlans, sizeof(EPlanEntry), nFPlans, trigger->tgoid);
+
+    /* CREATE OR REPLACE TRIGGER keeps the oid but not the arguments */
+    if(i >= 0 && FPlans[i].plan->stale){
+        if(same_args(FPlans[i].plan, trigger)){
+            FPlans[i].plan->stale = false;
+        }else if(FPlans[i].plan->busy > 0){
+            elog(ERROR, "cascade_timestamp: trigger \"%s\" was replaced while it was running",
+                    trigger->tgname);
+        }else{
+            free_plan(i);
+            i = -1;
         }
-        if(i != *nplans)
-            return (*eplan + i);
-        *eplan = (EPlan *)realloc(*eplan, (i + 1) * sizeof(EPlan));
-        newp = *eplan + i;
-    }else{
-        newp = *eplan = (EPlan *)malloc(sizeof(EPlan));
-        (*nplans) = i = 0;
     }
 
-    newp->ident = (char *)malloc(strlen(ident) + 1);
-    strcpy(newp->ident, ident);
+    if(i >= 0){
+        FPlans[i].plan->lastused = ++PlanClock;
+        return FPlans[i].plan;
+    }
+
+    if(PlanContext == NULL){
+        PlanContext = AllocSetContextCreate(CacheMemoryContext,
+                "cascade_timestamp plans", ALLOCSET_SMALL_SIZES);
+    }
+
+    while(MaxPlans > 0 && nFPlans >= MaxPlans && evict_plan())
+        ;
+
+    if(nFPlans == maxFPlans){
+        maxFPlans = maxFPlans == 0 ? 16 : maxFPlans * 2;
+        if(FPlans == NULL){
+            FPlans = (EPlanEntry *)MemoryContextAlloc(PlanContext,
+                    maxFPlans * sizeof(EPlanEntry));
+        }else{
+            FPlans = (EPlanEntry *)repalloc(FPlans,
+                    maxFPlans * sizeof(EPlanEntry));
+        }
+    }
+
+    plancontext = AllocSetContextCreate(PlanContext,
+            "cascade_timestamp plan", ALLOCSET_SMALL_SIZES);
+    newp = (EPlan *)MemoryContextAllocZero(plancontext, sizeof(EPlan));
+    newp->context = plancontext;
+    newp->trigger = trigger->tgoid;
+    oldcontext = MemoryContextSwitchTo(plancontext);
+    newp->ident = psprintf("%s on %s", trigger->tgname,
+            RelationGetRelationName(rel));
+    newp->relid = RelationGetRelid(rel);
+    newp->nargs = trigger->tgnargs;
+    newp->args = (char **)palloc(Max(trigger->tgnargs, 1) * sizeof(char *));
+    for(i = 0; i < trigger->tgnargs; i++)
+        newp->args[i] = pstrdup(trigger->tgargs[i]);
+    newp->stale = false;
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextSetIdentifier(plancontext, newp->ident);
     newp->plan = NULL;
-    (*nplans)++;
+    newp->busy = 0;
+    newp->lastused = ++PlanClock;
+    newp->configured = false;
+    newp->mapped = false;
+    newp->keyattnum = InvalidAttrNumber;
+    newp->keytype = InvalidOid;
+    newp->filters = NULL;
+    newp->predicate = NULL;
+    newp->typed = false;
+
+    FPlans[nFPlans].trigger = newp->trigger;
+    FPlans[nFPlans].plan = newp;
+    nFPlans++;
 
     return (newp);
 }
+
+/*
+ * Forget the least recently used plan that is not in use. Returns false if
+ * all of them are.
+ */
+static bool
+evict_plan(void){
+    int victim = -1;
+    int i;
+
+    for(i = 0; i < nFPlans; i++){
+        if(FPlans[i].plan->busy == 0 && (victim < 0 ||
+                FPlans[i].plan->lastused < FPlans[victim].plan->lastused))
+            victim = i;
+    }
+    if(victim < 0)
+        return false;
+
+    free_plan(victim);
+    return true;
+}
+
+/* Free a plan that is not in use and drop it from the index */
+static void
+free_plan(int i){
+    EPlan *plan = FPlans[i].plan;
+
+    if(plan->plan != NULL)
+        SPI_freeplan(plan->plan);
+    if(plan->predicate != NULL)
+        ct_predicate_free(plan->predicate);
+    if(plan->fastpath)
+        ct_direct_release(&plan->direct);
+    MemoryContextDelete(plan->context);
+
+    FPlans[i] = FPlans[--nFPlans];
+}
+
+/* Whether the trigger still has the arguments the plan was configured from */
+static bool
+same_args(EPlan *plan, Trigger *trigger){
+    int i;
+
+    if(plan->nargs != trigger->tgnargs)
+        return false;
+    for(i = 0; i < plan->nargs; i++){
+        if(strcmp(plan->args[i], trigger->tgargs[i]) != 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Replacing a trigger invalidates the relcache entry of its table, the
+ * plans of its triggers compare their arguments the next time they are used.
+ */
+static void
+plans_relcache_callback(Datum arg, Oid relid){
+    int i;
+
+    for(i = 0; i < nFPlans; i++){
+        if(relid == InvalidOid || FPlans[i].plan->relid == relid)
+            FPlans[i].plan->stale = true;
+    }
+}
+
+/*
+ * No invocation survives the end of the transaction, the ones that failed
+ * never released their plans.
+ */
+static void
+plans_xact_callback(XactEvent event, void *arg){
+    int i;
+
+    if(BusyPlans == 0 ||
+            (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT &&
+            event != XACT_EVENT_PREPARE))
+        return;
+
+    for(i = 0; i < nFPlans; i++)
+        FPlans[i].plan->busy = 0;
+    BusyPlans = 0;
+}
+
+/*
+ * cascade_timestamp_plan_cache() returns (plans integer, statements integer,
+ *     bytes bigint, bytes_per_plan bigint, hot_allocations bigint)
+ *
+ * The plan cache of the current backend. `bytes` is the memory of the
+ * "cascade_timestamp plans" context (NULL before PostgreSQL 13), the
+ * prepared statements themselves are accounted in their own "SPI Plan" and
+ * "CachedPlanSource" contexts. `hot_allocations` counts the invocations of
+ * warmed up plans that allocated in the current context, so not counting
+ * SPI and the executor, in builds with assertions only.
+ */
+Datum
+cascade_timestamp_plan_cache(PG_FUNCTION_ARGS){
+    TupleDesc tupdesc;
+    Datum values[5];
+    bool nulls[5];
+    int statements = 0;
+    int i;
+
+    if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "cascade_timestamp: return type must be a row type");
+
+    for(i = 0; i < nFPlans; i++){
+        if(FPlans[i].plan->plan != NULL)
+            statements++;
+    }
+
+    MemSet(nulls, 0, sizeof(nulls));
+    values[0] = Int32GetDatum(nFPlans);
+    values[1] = Int32GetDatum(statements);
+#if PG_VERSION_NUM >= 130000
+    if(PlanContext != NULL){
+        Size bytes = MemoryContextMemAllocated(PlanContext, true);
+
+        values[2] = Int64GetDatum((int64) bytes);
+        values[3] = Int64GetDatum(nFPlans > 0 ? (int64) bytes / nFPlans : 0);
+    }else{
+        values[2] = Int64GetDatum(0);
+        values[3] = Int64GetDatum(0);
+    }
+#else
+    nulls[2] = nulls[3] = true;
+#endif
+#ifdef USE_ASSERT_CHECKING
+    values[4] = Int64GetDatum(HotAllocations);
+#else
+    nulls[4] = true;
+#endif
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * True if an UPDATE from `oldslot` to `newslot` did not change the row.
+ * Heap tuples are compared as a whole, the rows of other table access
+ * methods column by column, reusing whatever the slots already deformed.
+ */
+static bool
+slots_equal(TupleTableSlot *newslot, TupleTableSlot *oldslot,
+        TupleDesc tupdesc){
+    CtTupleImage newimage, oldimage;
+    Form_pg_attribute attr;
+    int i;
+
+    if((TTS_IS_BUFFERTUPLE(newslot) || TTS_IS_HEAPTUPLE(newslot)) &&
+            (TTS_IS_BUFFERTUPLE(oldslot) || TTS_IS_HEAPTUPLE(oldslot))){
+        tuple_image(ExecFetchSlotHeapTuple(newslot, false, NULL), &newimage);
+        tuple_image(ExecFetchSlotHeapTuple(oldslot, false, NULL), &oldimage);
+        return ct_tuple_images_equal(&newimage, &oldimage);
+    }
+
+    slot_getallattrs(newslot);
+    slot_getallattrs(oldslot);
+    for(i = 0; i < tupdesc->natts; i++){
+        if(newslot->tts_isnull[i] != oldslot->tts_isnull[i])
+            return false;
+        if(newslot->tts_isnull[i])
+            continue;
+
+        attr = TupleDescAttr(tupdesc, i);
+        if(!datumIsEqual(newslot->tts_values[i], oldslot->tts_values[i],
+                    attr->attbyval, attr->attlen))
+            return false;
+    }
+    return true;
+}
+
+static void
+tuple_image(HeapTuple tuple, CtTupleImage *image){
+    HeapTupleHeader header = tuple->t_data;
+
+    image->len = tuple->t_len;
+    image->natts = HeapTupleHeaderGetNatts(header);
+    image->infomask = header->t_infomask & ~HEAP_XACT_MASK;
+    image->hoff = header->t_hoff;
+    image->bits = ((char *) header) + offsetof(HeapTupleHeaderData, t_bits);
+    image->bits_len = tuple->t_len - offsetof(HeapTupleHeaderData, t_bits);
+}
+
+/*
+ * Parse the trigger arguments following the four positional ones. Arguments
+ * of the form `name=value` are options, everything else is a
+ * (column, value) filter pair.
+ */
+static void
+configure_plan(EPlan *plan, Trigger *trigger){
+    char **args = trigger->tgargs;
+    char *value;
+    int i;
+
+    plan->storage = CT_STORAGE_UPDATE;
+    plan->sidecar = NULL;
+    plan->log = false;
+    plan->notify = NULL;
+    plan->fastpath = false;
+    plan->where = NULL;
+    plan->destination_where = NULL;
+    plan->stats = ct_stats_entry(trigger->tgoid);
+    plan->nfilters = 0;
+    plan->typed = true;
+    if(plan->filters == NULL)
+        plan->filters = (CtFilter *)MemoryContextAlloc(plan->context,
+                trigger->tgnargs * sizeof(CtFilter));
+
+    for(i = 4; i < trigger->tgnargs;){
+        value = strchr(args[i], '=');
+        if(value != NULL){
+            set_option(plan, args[i], value - args[i], value + 1);
+            i++;
+            continue;
+        }
+
+        if(i + 1 >= trigger->tgnargs){
+            elog(ERROR, "cascade_timestamp: filter column \"%s\" has no value",
+                    args[i]);
+        }
+        plan->filters[plan->nfilters].arg = i;
+        plan->filters[plan->nfilters].attnum = InvalidAttrNumber;
+        plan->filters[plan->nfilters].typid = InvalidOid;
+        plan->nfilters++;
+        i += 2;
+    }
+
+    if(plan->storage == CT_STORAGE_SIDECAR && plan->sidecar == NULL){
+        plan->sidecar = (char *)MemoryContextAlloc(plan->context,
+                strlen(args[0]) + sizeof("_cascade_timestamp"));
+        sprintf(plan->sidecar, "%s_cascade_timestamp", args[0]);
+    }
+
+    if((plan->storage == CT_STORAGE_SHMEM || plan->storage == CT_STORAGE_LAZY)
+            && !ct_map_available()){
+        elog(ERROR, "cascade_timestamp: storage=shmem and lazy require cascade_timestamp in shared_preload_libraries");
+    }
+
+    /* The write-back worker only connects to one database */
+    if(plan->storage == CT_STORAGE_SHMEM &&
+            get_database_oid(ct_map_database, true) != MyDatabaseId){
+        elog(ERROR, "cascade_timestamp: storage=shmem only works in cascade_timestamp.database (\"%s\")",
+                ct_map_database);
+    }
+
+    if((plan->storage == CT_STORAGE_SHMEM || plan->storage == CT_STORAGE_LAZY ||
+            plan->storage == CT_STORAGE_INPLACE) &&
+            plan->destination_where != NULL){
+        elog(ERROR, "cascade_timestamp: destination_where= does not work with storage=shmem, lazy and inplace");
+    }
+
+    plan->destination = DatumGetObjectId(DirectFunctionCall1(regclassin,
+            CStringGetDatum(args[0])));
+
+    if(plan->storage == CT_STORAGE_INPLACE){
+#if PG_VERSION_NUM < 140000 || PG_VERSION_NUM >= 180000
+        elog(ERROR, "cascade_timestamp: storage=inplace requires PostgreSQL 14 to 17");
+#endif
+        /* Overwriting is done by the fast path, which updates otherwise */
+        plan->fastpath = true;
+    }else if(plan->fastpath && plan->storage != CT_STORAGE_UPDATE){
+        elog(ERROR, "cascade_timestamp: fastpath=on requires storage=update");
+    }
+
+    /* The UPDATE checks it before locking the row, the direct path can not */
+    if(plan->destination_where != NULL)
+        plan->fastpath = false;
+
+    if(plan->fastpath){
+
+        plan->direct.destination = plan->destination;
+        plan->direct.tscolumn = MemoryContextStrdup(plan->context, args[1]);
+        plan->direct.keycolumn = MemoryContextStrdup(plan->context, args[2]);
+        plan->direct.tsattnum = InvalidAttrNumber;
+        plan->direct.keyattnum = InvalidAttrNumber;
+        plan->direct.inplace = (plan->storage == CT_STORAGE_INPLACE);
+        plan->direct.registered = false;
+        plan->direct.checked = false;
+        plan->direct.state = NULL;
+    }
+
+    plan->configured = true;
+}
+
+static void
+set_option(EPlan *plan, const char *name, int namelen, const char *value){
+    if(namelen == 7 && strncmp(name, "storage", namelen) == 0){
+        if(strcmp(value, "update") == 0)
+            plan->storage = CT_STORAGE_UPDATE;
+        else if(strcmp(value, "sidecar") == 0)
+            plan->storage = CT_STORAGE_SIDECAR;
+        else if(strcmp(value, "shmem") == 0)
+            plan->storage = CT_STORAGE_SHMEM;
+        else if(strcmp(value, "lazy") == 0)
+            plan->storage = CT_STORAGE_LAZY;
+        else if(strcmp(value, "inplace") == 0)
+            plan->storage = CT_STORAGE_INPLACE;
+        else
+            elog(ERROR, "cascade_timestamp: unknown storage \"%s\"", value);
+    }else if(namelen == 7 && strncmp(name, "sidecar", namelen) == 0){
+        plan->sidecar = MemoryContextStrdup(plan->context, value);
+        plan->storage = CT_STORAGE_SIDECAR;
+    }else if(namelen == 3 && strncmp(name, "log", namelen) == 0){
+        plan->log = DatumGetBool(DirectFunctionCall1(boolin,
+                CStringGetDatum(value)));
+    }else if(namelen == 6 && strncmp(name, "notify", namelen) == 0){
+        if(*value == '\0' || strlen(value) >= NAMEDATALEN)
+            elog(ERROR, "cascade_timestamp: invalid channel name \"%s\"", value);
+        plan->notify = MemoryContextStrdup(plan->context, value);
+    }else if(namelen == 5 && strncmp(name, "where", namelen) == 0){
+        plan->where = MemoryContextStrdup(plan->context, value);
+    }else if(namelen == 17 &&
+            strncmp(name, "destination_where", namelen) == 0){
+        plan->destination_where = MemoryContextStrdup(plan->context, value);
+    }else if(namelen == 8 && strncmp(name, "fastpath", namelen) == 0){
+        plan->fastpath = DatumGetBool(DirectFunctionCall1(boolin,
+                CStringGetDatum(value)));
+    }else if(namelen == 4 && strncmp(name, "lazy", namelen) == 0){
+        /* the column itself is only used by cascade_timestamp_lazy_get() */
+        plan->storage = CT_STORAGE_LAZY;
+    }else{
+        elog(ERROR, "cascade_timestamp: unknown option \"%.*s\"",
+                namelen, name);
+    }
+}
+
+/*
+ * Store the timestamp in the shared-memory map instead of updating the
+ * destination. Returns false if the caller has to update the destination
+ * after all.
+ */
+static bool
+cascade_to_map(EPlan *plan, char **args, Oid keytype, Datum kval){
+    if(!plan->mapped){
+        if(!ct_map_register(plan->destination, keytype, args[1], args[2])){
+            elog(WARNING, "cascade_timestamp: no room in the shared-memory map for \"%s\", updating it directly",
+                    args[0]);
+            plan->storage = CT_STORAGE_UPDATE;
+            return false;
+        }
+        plan->mapped = true;
+    }
+
+    return ct_map_set(plan->destination, key_text(plan, kval),
+            GetCurrentTransactionStartTimestamp());
+}
+
+/*
+ * Whether the column of the filter equals its value, a NULL column never
+ * rejects a row. Only CT_FILTER_OUTPUT allocates.
+ */
+static bool
+filter_matches(EPlan *plan, CtFilter *filter, TupleTableSlot *slot,
+        char **args, const char *relname){
+    Datum value;
+    bool isnull;
+    struct varlena *text;
+
+    resolve_filter(plan, filter, slot->tts_tupleDescriptor, args, relname);
+
+    value = slot_getattr(slot, filter->attnum, &isnull);
+    if(isnull)
+        return true;
+
+    switch(filter->kind){
+        case CT_FILTER_DATUM:
+            return value == filter->value;
+        case CT_FILTER_TEXT:
+            /* Compressed and out of line values are rare, use the output */
+            text = (struct varlena *) DatumGetPointer(value);
+            if(VARATT_IS_COMPRESSED(text) || VARATT_IS_EXTERNAL(text))
+                break;
+            return VARSIZE_ANY_EXHDR(text) == filter->len &&
+                    memcmp(VARDATA_ANY(text), args[filter->arg + 1],
+                    filter->len) == 0;
+    }
+
+    return ct_filter_matches(OidOutputFunctionCall(filter->output, value),
+            args[filter->arg + 1]);
+}
+
+/*
+ * Find the column of a filter and pick how to compare it, like
+ * resolve_key(). Pass-by-value columns compare the Datum of the value,
+ * which has to be valid input for the type.
+ */
+static void
+resolve_filter(EPlan *plan, CtFilter *filter, TupleDesc tupdesc,
+        char **args, const char *relname){
+    const char *column = args[filter->arg];
+    Form_pg_attribute attr;
+    bool isvarlena;
+    Oid input, ioparam;
+    int i;
+
+    if(filter->attnum > 0 && filter->attnum <= tupdesc->natts){
+        attr = TupleDescAttr(tupdesc, filter->attnum - 1);
+        if(!attr->attisdropped && attr->atttypid == filter->typid &&
+                strcmp(NameStr(attr->attname), column) == 0)
+            return;
+    }
+
+    filter->attnum = SPI_fnumber(tupdesc, column);
+    if(filter->attnum <= 0){
+        filter->attnum = InvalidAttrNumber;
+        elog(ERROR, "\"%s\" has no attribute \"%s\"", relname, column);
+    }
+
+    /* The type is only set once the value parsed, else it is tried again */
+    attr = TupleDescAttr(tupdesc, filter->attnum - 1);
+    filter->typid = InvalidOid;
+    getTypeOutputInfo(attr->atttypid, &filter->output, &isvarlena);
+    if(attr->attbyval){
+        getTypeInputInfo(attr->atttypid, &input, &ioparam);
+        filter->value = OidInputFunctionCall(input, args[filter->arg + 1],
+                ioparam, -1);
+        filter->kind = CT_FILTER_DATUM;
+    }else if(attr->atttypid == TEXTOID || attr->atttypid == VARCHAROID){
+        filter->len = strlen(args[filter->arg + 1]);
+        filter->kind = CT_FILTER_TEXT;
+    }else{
+        filter->kind = CT_FILTER_OUTPUT;
+    }
+    filter->typid = attr->atttypid;
+
+    plan->typed = true;
+    for(i = 0; i < plan->nfilters; i++){
+        if(plan->filters[i].attnum != InvalidAttrNumber &&
+                plan->filters[i].kind == CT_FILTER_OUTPUT)
+            plan->typed = false;
+    }
+}
+
+/*
+ * Find the source key column and pick the key path for its type. The
+ * cached column is reused as long as it still has that name and type, a
+ * changed type also invalidates the prepared statement.
+ */
+static void
+resolve_key(EPlan *plan, TupleDesc tupdesc, const char *column,
+        const char *relname){
+    Form_pg_attribute attr;
+    bool isvarlena;
+    Oid keytype;
+
+    if(plan->keyattnum > 0 && plan->keyattnum <= tupdesc->natts){
+        attr = TupleDescAttr(tupdesc, plan->keyattnum - 1);
+        if(!attr->attisdropped && attr->atttypid == plan->keytype &&
+                strcmp(NameStr(attr->attname), column) == 0)
+            return;
+    }
+
+    plan->keyattnum = SPI_fnumber(tupdesc, column);
+    if(plan->keyattnum <= 0){
+        plan->keyattnum = InvalidAttrNumber;
+        elog(ERROR, "\"%s\" has no attribute \"%s\"", relname, column);
+    }
+
+    keytype = TupleDescAttr(tupdesc, plan->keyattnum - 1)->atttypid;
+    if(keytype != plan->keytype && plan->plan != NULL){
+        SPI_freeplan(plan->plan);
+        plan->plan = NULL;
+    }
+    plan->keytype = keytype;
+
+    switch(keytype){
+        case INT2OID:
+            plan->keykind = CT_KEY_INT2;
+            break;
+        case INT4OID:
+            plan->keykind = CT_KEY_INT4;
+            break;
+        case INT8OID:
+            plan->keykind = CT_KEY_INT8;
+            break;
+        case UUIDOID:
+            plan->keykind = CT_KEY_UUID;
+            break;
+        default:
+            plan->keykind = CT_KEY_GENERIC;
+            getTypeOutputInfo(keytype, &plan->keyoutput, &isvarlena);
+            break;
+    }
+}
+
+/*
+ * The text representation of a key, as used in shared memory. Integer and
+ * uuid keys are rendered into the plan's buffer without calling the output
+ * function; the result is only valid until the next call. Only the
+ * rendering is specialized: the text is what identifies a key in every
+ * table that deduplicates or counts keys, as it is what the SQL functions
+ * take and return, so those tables hash and compare it like any other.
+ */
+static char *
+key_text(EPlan *plan, Datum kval){
+    switch(plan->keykind){
+        case CT_KEY_INT2:
+            ct_int64_text(DatumGetInt16(kval), plan->keybuf);
+            return plan->keybuf;
+        case CT_KEY_INT4:
+            ct_int64_text(DatumGetInt32(kval), plan->keybuf);
+            return plan->keybuf;
+        case CT_KEY_INT8:
+            ct_int64_text(DatumGetInt64(kval), plan->keybuf);
+            return plan->keybuf;
+        case CT_KEY_UUID:
+            ct_uuid_text(DatumGetUUIDP(kval)->data, plan->keybuf);
+            return plan->keybuf;
+    }
+
+    return OidOutputFunctionCall(plan->keyoutput, kval);
+}
+
+/*
+ * Append the key to the delta log, unless this transaction already did. The
+ * log row commits or rolls back together with the source row.
+ */
+static void
+cascade_to_log(EPlan *plan, Datum kval){
+    Oid argtypes[2] = {REGCLASSOID, TEXTOID};
+    Datum values[2];
+    char *key;
+    int ret;
+
+    key = key_text(plan, kval);
+    if(!ct_xact_log(plan->destination, key))
+        return;
+
+    if ((ret = SPI_connect()) < 0){
+        /* internal error */
+        elog(ERROR, "cascade_timestamp: SPI_connect returned %d", ret);
+    }
+
+    if(LogPlan == NULL){
+        LogPlan = SPI_prepare(
+                "INSERT INTO cascade_timestamp_log (destination, key, txid) "
+                "VALUES ($1, $2, txid_current())",
+                2, argtypes);
+        if(LogPlan == NULL){
+            /* internal error */
+            elog(ERROR, "cascade_timestamp: SPI_prepare returned %d", SPI_result);
+        }
+
+        LogPlan = SPI_saveplan(LogPlan);
+        if(LogPlan == NULL){
+            /* internal error */
+            elog(ERROR, "cascade_timestamp: SPI_saveplan returned %d", SPI_result);
+        }
+    }
+
+    values[0] = ObjectIdGetDatum(plan->destination);
+    values[1] = CStringGetTextDatum(key);
+
+    ret = SPI_execp(LogPlan, values, NULL, 0);
+    if (ret < 0){
+        elog(ERROR, "SPI_execp returned %d", ret);
+    }
+
+    SPI_finish();
+}
+
+/*
+ * Log a cascade that took at least cascade_timestamp.log_min_duration,
+ * with the lock it was waiting on if it was.
+ */
+static void
+log_slow_cascade(EPlan *plan, Trigger *trigger, Datum kval,
+        double elapsed){
+    char *waited = ct_activity_lock_waited();
+
+    if(waited != NULL){
+        elog(LOG, "cascade_timestamp: trigger \"%s\" took %.3f ms to cascade to key %s of %s, waiting for %s",
+                trigger->tgname, elapsed, key_text(plan, kval),
+                trigger->tgargs[0], waited);
+        pfree(waited);
+    }else{
+        elog(LOG, "cascade_timestamp: trigger \"%s\" took %.3f ms to cascade to key %s of %s",
+                trigger->tgname, elapsed, key_text(plan, kval),
+                trigger->tgargs[0]);
+    }
+}
@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Declarations shared between the cascade_timestamp source files.
+*/
+#ifndef CASCADE_TIMESTAMP_H
+#define CASCADE_TIMESTAMP_H
+
+#include "postgres.h"
+#include "access/tupdesc.h"
+#include "executor/tuptable.h"
+#include "fmgr.h"
+#include "lib/ilist.h"
+#include "portability/instr_time.h"
+#include "utils/relcache.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+/* Triggers get their rows as slots since PostgreSQL 12 */
+#if PG_VERSION_NUM < 120000
+#error "cascade_timestamp requires PostgreSQL 12 or later"
+#endif
+
+/* Keys are kept in shared memory in their text representation */
+#define CT_MAX_KEY_LEN      64
+
+/* cascade_timestamp.c */
+extern void _PG_init(void);
+
+/* cascade_timestamp_activity.c */
+extern void ct_activity_init(void);
+extern Size ct_activity_shmem_size(void);
+extern void ct_activity_shmem_request(void);
+extern void ct_activity_shmem_startup(void);
+extern bool ct_activity_available(void);
+extern uint32 ct_activity_wait_event(void);
+extern void ct_activity_start(Oid trigger, Oid destination, const char *key);
+extern void ct_activity_progress(int64 done, int64 total);
+extern void ct_activity_end(void);
+extern char *ct_activity_lock_waited(void);
+
+extern int ct_log_min_duration;
+
+/* cascade_timestamp_direct.c */
+typedef struct {
+    dlist_node node;        /* in the list of used destinations */
+    bool registered;
+    Oid destination;
+    char *tscolumn;
+    char *keycolumn;
+    AttrNumber tsattnum;    /* cached, InvalidAttrNumber until resolved */
+    AttrNumber keyattnum;
+    bool inplace;           /* storage=inplace */
+
+    /* Whether the direct path applies, kept until invalidated */
+    bool checked;
+    Oid checkeduser;
+    Oid checkedkeytype;
+    bool usable;
+    bool overwrite;         /* storage=inplace can overwrite the tuple */
+
+    /* The open destination for the rest of the statement, or NULL */
+    struct CtDirectState *state;
+} CtDirect;
+
+extern void ct_direct_init(void);
+extern void ct_direct_release(CtDirect *direct);
+extern bool ct_direct_update(CtDirect *direct, Oid keytype, Datum kval,
+        uint64 *processed);
+
+/* cascade_timestamp_predicate.c */
+typedef struct CtPredicate CtPredicate;
+
+extern void ct_predicate_init(void);
+extern CtPredicate *ct_predicate_compile(MemoryContext context, Relation rel,
+        const char *source);
+extern bool ct_predicate_matches(CtPredicate *pred, TupleTableSlot *slot);
+extern bool ct_predicate_stale(CtPredicate *pred);
+extern void ct_predicate_free(CtPredicate *pred);
+
+/* cascade_timestamp_shmem.c */
+extern void ct_map_init(void);
+extern Size ct_map_shmem_size(void);
+extern void ct_map_shmem_request(void);
+extern void ct_map_shmem_startup(void);
+extern bool ct_map_available(void);
+extern bool ct_map_register(Oid destination, Oid keytype,
+        const char *tscolumn, const char *keycolumn);
+extern bool ct_map_set(Oid destination, const char *key, TimestampTz ts);
+extern bool ct_map_get(Oid destination, const char *key, TimestampTz *ts);
+extern void ct_map_invalidate(Oid destination, const char *key);
+extern uint64 ct_map_generation(Oid destination, const char *key);
+extern bool ct_map_memoize(Oid destination, const char *key, TimestampTz ts,
+        uint64 generation);
+extern PGDLLEXPORT void cascade_timestamp_worker_main(Datum main_arg);
+
+extern char *ct_map_database;
+
+/* cascade_timestamp_stats.c */
+typedef enum {
+    CT_STAT_INVOCATIONS,
+    CT_STAT_NOOP,           /* updates skipped because nothing changed */
+    CT_STAT_FILTERED,       /* rows rejected by the filters */
+    CT_STAT_NULL_KEYS,
+    CT_STAT_PLANS,          /* plans prepared */
+    CT_STAT_UPDATES,        /* destination statements executed */
+    CT_STAT_ROWS,           /* destination rows affected */
+    CT_STAT_MISSING,        /* statements that affected no row */
+    CT_STAT_COUNT
+} CtStatCounter;
+
+typedef enum {
+    CT_TIME_TOTAL,          /* whole trigger invocations */
+    CT_TIME_STATEMENT,      /* destination statements */
+    CT_TIME_COUNT
+} CtTiming;
+
+#define CT_HIST_BUCKETS     32
+
+typedef struct CtStats CtStats;
+
+extern bool ct_track_timing;
+
+extern void ct_stats_init(void);
+extern Size ct_stats_shmem_size(void);
+extern void ct_stats_shmem_request(void);
+extern void ct_stats_shmem_startup(void);
+extern CtStats *ct_stats_entry(Oid trigger);
+extern void ct_stats_add(CtStats *stats, CtStatCounter counter, uint64 value);
+extern void ct_stats_time(CtStats *stats, CtTiming kind, instr_time duration);
+extern Tuplestorestate *ct_materialize(FunctionCallInfo fcinfo,
+        TupleDesc *tupdesc);
+
+/* cascade_timestamp_summary.c */
+extern int ct_statement_summary;
+extern uint64 ct_statement_counters[CT_STAT_COUNT];
+
+extern void ct_summary_init(void);
+extern void ct_summary_enter(void);
+extern void ct_summary_leave(void);
+extern void ct_summary_time(instr_time duration);
+extern void ct_summary_key(Oid destination, const char *key);
+
+/* cascade_timestamp_top.c */
+extern void ct_top_init(void);
+extern Size ct_top_shmem_size(void);
+extern void ct_top_shmem_request(void);
+extern void ct_top_shmem_startup(void);
+extern bool ct_top_available(void);
+extern void ct_top_count(Oid destination, const char *key);
+
+/* cascade_timestamp_xact.c */
+extern void ct_xact_init(void);
+extern void ct_xact_invalidate(Oid destination, const char *key);
+extern bool ct_xact_log(Oid destination, const char *key);
+extern void ct_xact_notify(Oid destination, const char *channel,
+        const char *key);
+
+#endif   /* CASCADE_TIMESTAMP_H */
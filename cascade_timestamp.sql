@@ -6,3 +6,384 @@ CREATE OR REPLACE FUNCTION cascade_timestamp()
 RETURNS trigger AS 'cascade_timestamp.so'
 LANGUAGE C;
 
+
+-- Create the narrow sidecar table used by `storage=sidecar` together with a
+-- `<destination>_cascaded` view that joins the sidecar timestamp back onto
+-- the destination rows.
+CREATE OR REPLACE FUNCTION cascade_timestamp_sidecar(
+    destination regclass,
+    timestamp_column name,
+    key_column name,
+    unlogged boolean DEFAULT true
+) RETURNS regclass AS $$
+DECLARE
+    schema_name name;
+    table_name name;
+    key_type text;
+    timestamp_type text;
+    columns text;
+BEGIN
+    SELECT n.nspname, c.relname INTO schema_name, table_name
+    FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace
+    WHERE c.oid = destination;
+
+    SELECT format_type(atttypid, atttypmod) INTO key_type
+    FROM pg_attribute
+    WHERE attrelid = destination AND attname = key_column
+        AND NOT attisdropped;
+    IF key_type IS NULL THEN
+        RAISE EXCEPTION '"%" has no attribute "%"', destination, key_column;
+    END IF;
+
+    SELECT format_type(atttypid, atttypmod) INTO timestamp_type
+    FROM pg_attribute
+    WHERE attrelid = destination AND attname = timestamp_column
+        AND NOT attisdropped;
+    IF timestamp_type IS NULL THEN
+        RAISE EXCEPTION '"%" has no attribute "%"', destination,
+            timestamp_column;
+    END IF;
+
+    EXECUTE format(
+        'CREATE %s TABLE IF NOT EXISTS %I.%I (%I %s PRIMARY KEY, %I %s NOT NULL)',
+        CASE WHEN unlogged THEN 'UNLOGGED' ELSE '' END,
+        schema_name, table_name || '_cascade_timestamp',
+        key_column, key_type, timestamp_column, timestamp_type);
+
+    SELECT string_agg(CASE
+            WHEN attname = timestamp_column
+            THEN format('greatest(p.%1$I, s.%1$I) AS %1$I', attname)
+            ELSE format('p.%I', attname)
+        END, ', ' ORDER BY attnum) INTO columns
+    FROM pg_attribute
+    WHERE attrelid = destination AND attnum > 0 AND NOT attisdropped;
+
+    EXECUTE format(
+        'CREATE OR REPLACE VIEW %I.%I AS SELECT %s FROM %s p '
+        'LEFT JOIN %I.%I s ON s.%I = p.%I',
+        schema_name, table_name || '_cascaded', columns, destination,
+        schema_name, table_name || '_cascade_timestamp',
+        key_column, key_column);
+
+    RETURN format('%I.%I', schema_name,
+        table_name || '_cascade_timestamp')::regclass;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_shmem_get(regclass, text)
+RETURNS timestamptz AS 'cascade_timestamp.so'
+LANGUAGE C STRICT;
+
+-- Timestamp of a destination row for `storage=shmem` triggers. Reads the
+-- shared-memory map and falls back to the destination table on a miss.
+CREATE OR REPLACE FUNCTION cascade_timestamp_get(
+    destination regclass,
+    key anyelement
+) RETURNS timestamptz AS $$
+DECLARE
+    result timestamptz;
+    args text[];
+BEGIN
+    result := cascade_timestamp_shmem_get(destination, key::text);
+    IF result IS NOT NULL THEN
+        RETURN result;
+    END IF;
+
+    SELECT a INTO args
+    FROM (
+        SELECT string_to_array(encode(t.tgargs, 'escape'), '\000') AS a
+        FROM pg_trigger t
+        WHERE t.tgfoid = 'cascade_timestamp()'::regprocedure
+    ) triggers
+    WHERE to_regclass(a[1]) = destination
+    LIMIT 1;
+    IF args IS NULL THEN
+        RAISE EXCEPTION 'cascade_timestamp: no trigger cascades to %',
+            destination;
+    END IF;
+
+    EXECUTE format('SELECT %s FROM %s WHERE %s = $1', args[2], destination,
+        args[3])
+    INTO result USING key;
+    RETURN result;
+END;
+$$ LANGUAGE plpgsql STABLE;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_memo_generation(regclass, text)
+RETURNS bigint AS 'cascade_timestamp.so'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_memo_set(regclass, text,
+    timestamptz, bigint)
+RETURNS boolean AS 'cascade_timestamp.so'
+LANGUAGE C STRICT;
+
+-- Effective timestamp of a destination row for `lazy=column` triggers: the
+-- newest `column` of the source rows referencing it that pass the filter
+-- pairs and `where=` of the trigger, compared like the trigger compares
+-- them. The result is memoized in shared memory until a trigger invalidates
+-- it. An index on `(source_key, column)` of every source table keeps the
+-- computation cheap.
+--
+-- This function is VOLATILE on purpose: every query then takes a fresh
+-- snapshot, which has to be newer than the generation read up front.
+CREATE OR REPLACE FUNCTION cascade_timestamp_lazy_get(
+    destination regclass,
+    key anyelement
+) RETURNS timestamptz AS $$
+DECLARE
+    generation bigint;
+    result timestamptz;
+    source_result timestamptz;
+    source record;
+    conditions text;
+    byval boolean;
+    i integer;
+BEGIN
+    generation := cascade_timestamp_memo_generation(destination, key::text);
+    result := cascade_timestamp_shmem_get(destination, key::text);
+    IF result IS NOT NULL THEN
+        RETURN result;
+    END IF;
+
+    FOR source IN
+        SELECT t.tgrelid::regclass AS relation, t.a AS args,
+            substr(o, 6) AS timestamp_column
+        FROM (
+            SELECT tgrelid, string_to_array(encode(tgargs, 'escape'), '\000') AS a
+            FROM pg_trigger
+            WHERE tgfoid = 'cascade_timestamp()'::regprocedure
+        ) t, unnest(t.a[5:array_length(t.a, 1)]) AS o
+        WHERE to_regclass(t.a[1]) = destination AND o LIKE 'lazy=%'
+    LOOP
+        -- The row filters of the trigger, a NULL column passes the pairs
+        conditions := format('%s = $1', source.args[4]);
+        i := 5;
+        WHILE i <= array_length(source.args, 1) LOOP
+            IF position('=' IN source.args[i]) > 0 THEN
+                IF source.args[i] LIKE 'where=%' THEN
+                    conditions := conditions || format(' AND (%s)',
+                        substr(source.args[i], 7));
+                END IF;
+                i := i + 1;
+                CONTINUE;
+            END IF;
+
+            SELECT ty.typbyval INTO byval
+            FROM pg_attribute at JOIN pg_type ty ON ty.oid = at.atttypid
+            WHERE at.attrelid = source.relation
+                AND at.attname = source.args[i] AND NOT at.attisdropped;
+            conditions := conditions || format(
+                CASE WHEN byval THEN ' AND (%1$I IS NULL OR %1$I = %2$L)'
+                    ELSE ' AND (%1$I IS NULL OR %1$I::text = %2$L)' END,
+                source.args[i], source.args[i + 1]);
+            i := i + 2;
+        END LOOP;
+
+        EXECUTE format('SELECT max(%s) FROM %s WHERE %s',
+            source.timestamp_column, source.relation, conditions)
+        INTO source_result USING key;
+        result := greatest(result, source_result);
+    END LOOP;
+
+    IF result IS NOT NULL AND generation IS NOT NULL THEN
+        PERFORM cascade_timestamp_memo_set(destination, key::text, result,
+            generation);
+    END IF;
+    RETURN result;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Delta log for `log=on` triggers. Every transaction appends each destination
+-- key it cascaded to once. Consumers read the log in batches of committed
+-- transactions (PgQ style): a batch holds the entries of all transactions that
+-- committed between the consumer's acknowledged snapshot and the snapshot
+-- taken by cascade_timestamp_log_read(). Unlike a plain `position > $last`
+-- this can't skip entries of transactions that commit out of order.
+CREATE TABLE IF NOT EXISTS cascade_timestamp_log (
+    position bigserial PRIMARY KEY,
+    destination regclass NOT NULL,
+    key text NOT NULL,
+    txid bigint NOT NULL
+);
+
+CREATE INDEX IF NOT EXISTS cascade_timestamp_log_txid
+    ON cascade_timestamp_log (txid);
+
+CREATE TABLE IF NOT EXISTS cascade_timestamp_log_consumer (
+    name text PRIMARY KEY,
+    snapshot txid_snapshot NOT NULL,   -- acknowledged
+    pending txid_snapshot              -- read but not yet acknowledged
+);
+
+-- Start consuming the log from now on.
+CREATE OR REPLACE FUNCTION cascade_timestamp_log_subscribe(consumer text)
+RETURNS void AS $$
+    INSERT INTO cascade_timestamp_log_consumer (name, snapshot)
+    VALUES (consumer, txid_current_snapshot())
+    ON CONFLICT (name) DO NOTHING;
+$$ LANGUAGE sql;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_log_unsubscribe(consumer text)
+RETURNS void AS $$
+    DELETE FROM cascade_timestamp_log_consumer WHERE name = consumer;
+$$ LANGUAGE sql;
+
+-- Entries committed since the last acknowledged batch, in log order. Reading
+-- again before acknowledging returns the unacknowledged entries again, plus
+-- whatever committed in the meantime.
+CREATE OR REPLACE FUNCTION cascade_timestamp_log_read(consumer text)
+RETURNS TABLE (
+    "position" bigint,
+    destination regclass,
+    key text,
+    txid bigint
+) AS $$
+DECLARE
+    last_snapshot txid_snapshot;
+    current_snapshot txid_snapshot := txid_current_snapshot();
+BEGIN
+    SELECT c.snapshot INTO last_snapshot
+    FROM cascade_timestamp_log_consumer c
+    WHERE c.name = consumer
+    FOR UPDATE;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'cascade_timestamp: unknown consumer "%"', consumer;
+    END IF;
+
+    UPDATE cascade_timestamp_log_consumer c
+    SET pending = current_snapshot
+    WHERE c.name = consumer;
+
+    RETURN QUERY
+    SELECT l.position, l.destination, l.key, l.txid
+    FROM cascade_timestamp_log l
+    WHERE l.txid >= txid_snapshot_xmin(last_snapshot)
+        AND l.txid < txid_snapshot_xmax(current_snapshot)
+        AND txid_visible_in_snapshot(l.txid, current_snapshot)
+        AND NOT txid_visible_in_snapshot(l.txid, last_snapshot)
+    ORDER BY l.position;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Acknowledge the batch returned by the last cascade_timestamp_log_read().
+CREATE OR REPLACE FUNCTION cascade_timestamp_log_ack(consumer text)
+RETURNS boolean AS $$
+    UPDATE cascade_timestamp_log_consumer
+    SET snapshot = pending, pending = NULL
+    WHERE name = consumer AND pending IS NOT NULL
+    RETURNING true;
+$$ LANGUAGE sql;
+
+-- Remove the entries every consumer has acknowledged.
+CREATE OR REPLACE FUNCTION cascade_timestamp_log_trim()
+RETURNS bigint AS $$
+    WITH trimmed AS (
+        DELETE FROM cascade_timestamp_log l
+        WHERE EXISTS (SELECT 1 FROM cascade_timestamp_log_consumer)
+            AND NOT EXISTS (
+                SELECT 1 FROM cascade_timestamp_log_consumer c
+                WHERE NOT txid_visible_in_snapshot(l.txid, c.snapshot)
+            )
+        RETURNING 1
+    )
+    SELECT count(*) FROM trimmed;
+$$ LANGUAGE sql;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_stats(
+    OUT trigger oid,
+    OUT invocations bigint,
+    OUT noop_updates bigint,
+    OUT filtered bigint,
+    OUT null_keys bigint,
+    OUT plans_prepared bigint,
+    OUT updates bigint,
+    OUT rows_updated bigint,
+    OUT missing_destinations bigint
+) RETURNS SETOF record AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_stats_reset(trigger oid DEFAULT NULL)
+RETURNS void AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION cascade_timestamp_stats_reset(oid) FROM PUBLIC;
+
+CREATE OR REPLACE VIEW cascade_timestamp_stats AS
+SELECT s.trigger, t.tgname AS trigger_name, t.tgrelid::regclass AS relation,
+    s.invocations, s.noop_updates, s.filtered, s.null_keys, s.plans_prepared,
+    s.updates, s.rows_updated, s.missing_destinations
+FROM cascade_timestamp_stats() s
+LEFT JOIN pg_trigger t ON t.oid = s.trigger;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_histogram(
+    OUT trigger oid,
+    OUT kind text,
+    OUT lower_us bigint,
+    OUT upper_us bigint,
+    OUT count bigint
+) RETURNS SETOF record AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_latency(
+    OUT trigger oid,
+    OUT kind text,
+    OUT count bigint,
+    OUT p50_us float8,
+    OUT p90_us float8,
+    OUT p99_us float8,
+    OUT p999_us float8
+) RETURNS SETOF record AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE VIEW cascade_timestamp_latency AS
+SELECT l.trigger, t.tgname AS trigger_name, t.tgrelid::regclass AS relation,
+    l.kind, l.count, l.p50_us, l.p90_us, l.p99_us, l.p999_us
+FROM cascade_timestamp_latency() l
+LEFT JOIN pg_trigger t ON t.oid = l.trigger;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_top_keys(
+    OUT destination regclass,
+    OUT key text,
+    OUT count bigint,
+    OUT error bigint
+) RETURNS SETOF record AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_top_keys_reset()
+RETURNS void AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION cascade_timestamp_top_keys_reset() FROM PUBLIC;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_top_keys_skipped()
+RETURNS bigint AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_activity(
+    OUT pid integer,
+    OUT trigger oid,
+    OUT destination regclass,
+    OUT key text,
+    OUT started timestamptz,
+    OUT done bigint,
+    OUT total bigint
+) RETURNS SETOF record AS 'cascade_timestamp.so'
+LANGUAGE C;
+
+CREATE OR REPLACE VIEW cascade_timestamp_activity AS
+SELECT c.pid, t.tgname AS trigger_name, c.destination, c.key, c.started,
+    c.done, c.total, a.wait_event_type, a.wait_event, a.query,
+    pg_blocking_pids(c.pid) AS blocked_by
+FROM cascade_timestamp_activity() c
+JOIN pg_stat_activity a ON a.pid = c.pid
+LEFT JOIN pg_trigger t ON t.oid = c.trigger;
+
+CREATE OR REPLACE FUNCTION cascade_timestamp_plan_cache(
+    OUT plans integer,
+    OUT statements integer,
+    OUT bytes bigint,
+    OUT bytes_per_plan bigint,
+    OUT hot_allocations bigint
+) RETURNS record AS 'cascade_timestamp.so'
+LANGUAGE C;
@@ -0,0 +1,370 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+What each backend is cascading right now.
+
+A wait event only means something while the backend sleeps, and the
+server's own waits replace and then clear whatever was set around them. So
+the cascade itself reports none: a cascade stuck on the destination row
+lock shows the `Lock` wait like any other statement, and nothing while it
+runs on the CPU. The only wait of its own is that of the write-back worker
+of `storage=shmem` between flushes, `CascadeTimestampWriteBack`
+(`Extension` before PostgreSQL 17).
+
+To tell which cascade is stuck on what every backend publishes the
+trigger, destination and key it is cascading to in a shared array with one
+slot per PGPROC, readable
+through `cascade_timestamp_activity()` and joinable with `pg_stat_activity`
+and `pg_locks` on the pid. The write-back worker of `storage=shmem` uses its
+slot to report how far its flush got. The progress reporting API of the
+server only knows about built-in commands, so this array is also where the
+progress of that batch is reported.
+
+Slots are only written by their owner and read without locks, using the
+same change count protocol as `pg_stat_activity`.
+
+With `cascade_timestamp.log_min_duration` a timeout fires once the
+destination statement has run that long, and notes the lock the backend is
+waiting on at that moment so the slow cascade log can name it: usually the
+transaction holding the destination row, or the tuple lock queue in front
+of it.
+
+Requires `shared_preload_libraries = 'cascade_timestamp'`.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/twophase.h"
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/lock.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/timeout.h"
+
+typedef struct {
+    uint32 changecount;     /* odd while the slot is being written */
+    int pid;                /* 0 if the backend is not cascading */
+    Oid dboid;
+    Oid trigger;            /* InvalidOid for the write-back worker */
+    Oid destination;
+    char key[CT_MAX_KEY_LEN];
+    TimestampTz started;
+    int64 done;
+    int64 total;
+} CtActivity;
+
+extern Datum cascade_timestamp_activity(PG_FUNCTION_ARGS);
+
+static CtActivity *ct_activity = NULL;
+static CtActivity *ct_my_activity = NULL;
+static int ct_activity_nslots = 0;
+static uint32 ct_wait_event = 0;
+
+int ct_log_min_duration = -1;
+
+static TimeoutId ct_slow_timeout = MAX_TIMEOUTS;
+static bool ct_slow_armed = false;
+static volatile sig_atomic_t ct_slow_waited = false;
+static LOCKTAG ct_slow_locktag;
+
+static int ct_activity_slots(void);
+static CtActivity *ct_activity_begin_write(void);
+static void ct_activity_end_write(CtActivity *activity);
+static void ct_slow_timeout_handler(void);
+static void ct_activity_xact_callback(XactEvent event, void *arg);
+static void ct_activity_subxact_callback(SubXactEvent event,
+        SubTransactionId mySubid, SubTransactionId parentSubid, void *arg);
+
+PG_FUNCTION_INFO_V1(cascade_timestamp_activity);
+
+void
+ct_activity_init(void){
+    DefineCustomIntVariable("cascade_timestamp.log_min_duration",
+            "Logs cascades whose destination statement takes at least this long, -1 disables it.",
+            NULL,
+            &ct_log_min_duration,
+            -1, -1, INT_MAX,
+            PGC_SUSET,
+            GUC_UNIT_MS,
+            NULL, NULL, NULL);
+
+    RegisterXactCallback(ct_activity_xact_callback, NULL);
+    RegisterSubXactCallback(ct_activity_subxact_callback, NULL);
+}
+
+Size
+ct_activity_shmem_size(void){
+    return mul_size(ct_activity_slots(), sizeof(CtActivity));
+}
+
+void
+ct_activity_shmem_request(void){
+    RequestAddinShmemSpace(ct_activity_shmem_size());
+}
+
+void
+ct_activity_shmem_startup(void){
+    bool found;
+
+    ct_activity_nslots = ct_activity_slots();
+    ct_activity = ShmemInitStruct("cascade_timestamp activity",
+            ct_activity_shmem_size(), &found);
+    if(!found)
+        MemSet(ct_activity, 0, ct_activity_shmem_size());
+}
+
+bool
+ct_activity_available(void){
+    return ct_activity != NULL;
+}
+
+/* The wait event of the write-back worker sleeping between flushes */
+uint32
+ct_activity_wait_event(void){
+    if(ct_wait_event == 0){
+#if PG_VERSION_NUM >= 170000
+        ct_wait_event = WaitEventExtensionNew("CascadeTimestampWriteBack");
+#else
+        ct_wait_event = PG_WAIT_EXTENSION;
+#endif
+    }
+
+    return ct_wait_event;
+}
+
+/*
+ * Publish that this backend starts cascading to `key` of `destination`.
+ * Every start has to be followed by ct_activity_end(), errors are taken
+ * care of by the transaction callbacks.
+ */
+void
+ct_activity_start(Oid trigger, Oid destination, const char *key){
+    CtActivity *activity;
+
+    activity = ct_activity_begin_write();
+    if(activity != NULL){
+        activity->pid = MyProcPid;
+        activity->dboid = MyDatabaseId;
+        activity->trigger = trigger;
+        activity->destination = destination;
+        strlcpy(activity->key, key != NULL ? key : "", CT_MAX_KEY_LEN);
+        activity->started = GetCurrentTimestamp();
+        activity->done = 0;
+        activity->total = 0;
+        ct_activity_end_write(activity);
+    }
+
+    ct_slow_waited = false;
+    if(ct_log_min_duration > 0){
+        if(ct_slow_timeout == MAX_TIMEOUTS){
+            ct_slow_timeout = RegisterTimeout(USER_TIMEOUT,
+                    ct_slow_timeout_handler);
+        }
+        enable_timeout_after(ct_slow_timeout, ct_log_min_duration);
+        ct_slow_armed = true;
+    }
+}
+
+/* Report how much of a batch is done */
+void
+ct_activity_progress(int64 done, int64 total){
+    CtActivity *activity = ct_activity_begin_write();
+
+    if(activity != NULL){
+        activity->done = done;
+        activity->total = total;
+        ct_activity_end_write(activity);
+    }
+}
+
+void
+ct_activity_end(void){
+    CtActivity *activity;
+
+    if(ct_slow_armed){
+        disable_timeout(ct_slow_timeout, false);
+        ct_slow_armed = false;
+    }
+
+    activity = ct_activity_begin_write();
+    if(activity != NULL){
+        activity->pid = 0;
+        ct_activity_end_write(activity);
+    }
+}
+
+/*
+ * Describe the lock the last cascade was waiting on when it passed
+ * `cascade_timestamp.log_min_duration`, NULL if it was not waiting.
+ */
+char *
+ct_activity_lock_waited(void){
+    LOCKTAG tag;
+    int pid;
+
+    if(!ct_slow_waited)
+        return NULL;
+
+    tag = ct_slow_locktag;
+    switch(tag.locktag_type){
+        case LOCKTAG_TRANSACTION:
+            pid = BackendXidGetPid(tag.locktag_field1);
+            if(pid == 0)
+                return psprintf("transaction %u", tag.locktag_field1);
+            return psprintf("transaction %u (pid %d)", tag.locktag_field1, pid);
+        case LOCKTAG_TUPLE:
+            return psprintf("tuple (%u,%u) of relation %u",
+                    tag.locktag_field3, tag.locktag_field4,
+                    tag.locktag_field2);
+        default:
+            return psprintf("%s lock", LockTagTypeNames[tag.locktag_type]);
+    }
+}
+
+/*
+ * cascade_timestamp_activity() returns (pid int, trigger oid,
+ *     destination regclass, key text, started timestamptz, done bigint,
+ *     total bigint)
+ *
+ * The cascades running in the current database. `trigger` is NULL for the
+ * write-back worker, which reports the entries of its current flush as
+ * done / total.
+ */
+Datum
+cascade_timestamp_activity(PG_FUNCTION_ARGS){
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    CtActivity copy;
+    volatile CtActivity *activity;
+    uint32 before, after;
+    Datum values[7];
+    bool nulls[7];
+    int i;
+
+    tupstore = ct_materialize(fcinfo, &tupdesc);
+    if(ct_activity == NULL)
+        return (Datum) 0;
+
+    for(i = 0; i < ct_activity_nslots; i++){
+        activity = &ct_activity[i];
+
+        /* Retry until the slot was not written while copying it */
+        for(;;){
+            before = activity->changecount;
+            pg_read_barrier();
+            memcpy(&copy, (CtActivity *)activity, sizeof(CtActivity));
+            pg_read_barrier();
+            after = activity->changecount;
+            if(before == after && (before & 1) == 0)
+                break;
+            CHECK_FOR_INTERRUPTS();
+        }
+
+        if(copy.pid == 0 || copy.dboid != MyDatabaseId)
+            continue;
+
+        copy.key[CT_MAX_KEY_LEN - 1] = '\0';
+        MemSet(nulls, 0, sizeof(nulls));
+        values[0] = Int32GetDatum(copy.pid);
+        values[1] = ObjectIdGetDatum(copy.trigger);
+        nulls[1] = !OidIsValid(copy.trigger);
+        values[2] = ObjectIdGetDatum(copy.destination);
+        nulls[2] = !OidIsValid(copy.destination);
+        values[3] = CStringGetTextDatum(copy.key);
+        nulls[3] = (copy.key[0] == '\0');
+        values[4] = TimestampTzGetDatum(copy.started);
+        values[5] = Int64GetDatum(copy.done);
+        values[6] = Int64GetDatum(copy.total);
+        nulls[5] = nulls[6] = (copy.total == 0);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+
+/*
+ * One slot for every PGPROC. MaxBackends is only known once the libraries
+ * are loaded, before PostgreSQL 15 it is computed the same way here.
+ */
+static int
+ct_activity_slots(void){
+#if PG_VERSION_NUM >= 150000
+    return MaxBackends + NUM_AUXILIARY_PROCS + max_prepared_xacts;
+#else
+    return MaxConnections + autovacuum_max_workers + 1 +
+            max_worker_processes + max_wal_senders + NUM_AUXILIARY_PROCS +
+            max_prepared_xacts;
+#endif
+}
+
+static CtActivity *
+ct_activity_begin_write(void){
+    int slot;
+
+    if(ct_activity == NULL || MyProc == NULL)
+        return NULL;
+
+    if(ct_my_activity == NULL){
+#if PG_VERSION_NUM >= 170000
+        slot = MyProcNumber;
+#else
+        slot = MyProc->pgprocno;
+#endif
+        if(slot < 0 || slot >= ct_activity_nslots)
+            return NULL;
+        ct_my_activity = &ct_activity[slot];
+    }
+
+    ct_my_activity->changecount++;
+    pg_write_barrier();
+    return ct_my_activity;
+}
+
+static void
+ct_activity_end_write(CtActivity *activity){
+    pg_write_barrier();
+    activity->changecount++;
+}
+
+/*
+ * Runs in the signal handler, only copies the lock tag the backend is
+ * sleeping on (set and cleared by the backend itself).
+ */
+static void
+ct_slow_timeout_handler(void){
+    LOCK *lock = MyProc->waitLock;
+
+    if(lock != NULL){
+        ct_slow_locktag = lock->tag;
+        ct_slow_waited = true;
+    }
+}
+
+static void
+ct_activity_xact_callback(XactEvent event, void *arg){
+    CtActivity *activity;
+
+    if(event != XACT_EVENT_ABORT || ct_my_activity == NULL ||
+            ct_my_activity->pid == 0)
+        return;
+
+    activity = ct_activity_begin_write();
+    activity->pid = 0;
+    ct_activity_end_write(activity);
+}
+
+static void
+ct_activity_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+        SubTransactionId parentSubid, void *arg){
+    if(event == SUBXACT_EVENT_ABORT_SUB)
+        ct_activity_xact_callback(XACT_EVENT_ABORT, arg);
+}
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Server-independent per-row routines, see cascade_timestamp_core.h.
+*/
+
+#include "cascade_timestamp_core.h"
+
+#include <string.h>
+
+/* True if an UPDATE from `b` to `a` did not change the tuple payload */
+bool
+ct_tuple_images_equal(const CtTupleImage *a, const CtTupleImage *b){
+    return a->len == b->len &&
+            a->hoff == b->hoff &&
+            a->natts == b->natts &&
+            a->infomask == b->infomask &&
+            memcmp(a->bits, b->bits, a->bits_len) == 0;
+}
+
+/* A NULL column value never rejects a row */
+bool
+ct_filter_matches(const char *value, const char *expected){
+    return value == NULL || strcmp(value, expected) == 0;
+}
+
+/*
+ * Index of the entry with this oid, or -1. Every entry is `stride` bytes
+ * and starts with the (32-bit) oid.
+ */
+int
+ct_find_oid(const void *entries, size_t stride, int nentries, uint32_t oid){
+    const char *entry = (const char *) entries;
+    int i;
+
+    for(i = 0; i < nentries; i++, entry += stride){
+        if(*(const uint32_t *) entry == oid)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Write the decimal representation of `value` to `buf`, which must hold
+ * CT_INT64_TEXT_LEN bytes. Returns the length. Matches int8out().
+ */
+int
+ct_int64_text(int64_t value, char *buf){
+    char tmp[CT_INT64_TEXT_LEN];
+    uint64_t uvalue;
+    int len = 0;
+    int i = 0;
+
+    if(value < 0){
+        buf[len++] = '-';
+        uvalue = (uint64_t) 0 - (uint64_t) value;
+    }else{
+        uvalue = (uint64_t) value;
+    }
+
+    do{
+        tmp[i++] = (char) ('0' + uvalue % 10);
+        uvalue /= 10;
+    }while(uvalue > 0);
+
+    while(i > 0)
+        buf[len++] = tmp[--i];
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+ * Write the text representation of the 16 bytes of `uuid` to `buf`, which
+ * must hold CT_UUID_TEXT_LEN bytes. Returns the length. Matches uuid_out().
+ */
+int
+ct_uuid_text(const unsigned char *uuid, char *buf){
+    static const char hex[] = "0123456789abcdef";
+    int len = 0;
+    int i;
+
+    for(i = 0; i < 16; i++){
+        if(i == 4 || i == 6 || i == 8 || i == 10)
+            buf[len++] = '-';
+        buf[len++] = hex[uuid[i] >> 4];
+        buf[len++] = hex[uuid[i] & 0x0f];
+    }
+    buf[len] = '\0';
+
+    return len;
+}
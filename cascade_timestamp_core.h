@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+The per-row routines of the trigger that do not depend on the server, so
+they can be built into bench/microbench and timed in isolation. Nothing in
+here may include postgres.h or allocate memory.
+*/
+#ifndef CASCADE_TIMESTAMP_CORE_H
+#define CASCADE_TIMESTAMP_CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest text representation of a 64-bit integer, including the NUL */
+#define CT_INT64_TEXT_LEN   21
+
+/* Length of the text representation of a uuid, including the NUL */
+#define CT_UUID_TEXT_LEN    37
+
+/*
+ * The parts of a heap tuple image that decide whether an UPDATE changed
+ * anything: the header fields that describe the data and everything from
+ * the null bitmap onwards.
+ */
+typedef struct {
+    uint32_t len;           /* t_len */
+    uint16_t natts;
+    uint16_t infomask;      /* t_infomask without the transaction bits */
+    uint8_t hoff;
+    const char *bits;       /* &t_bits, followed by the data */
+    size_t bits_len;
+} CtTupleImage;
+
+extern bool ct_tuple_images_equal(const CtTupleImage *a,
+        const CtTupleImage *b);
+extern bool ct_filter_matches(const char *value, const char *expected);
+extern int ct_find_oid(const void *entries, size_t stride, int nentries,
+        uint32_t oid);
+extern int ct_int64_text(int64_t value, char *buf);
+extern int ct_uuid_text(const unsigned char *uuid, char *buf);
+
+#endif   /* CASCADE_TIMESTAMP_CORE_H */
@@ -0,0 +1,876 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Direct update of the destination row for `fastpath=on`.
+
+Instead of running the saved `UPDATE destination SET ts = NOW() WHERE key =
+$1` through SPI and the executor, the row is looked up through the primary
+key index and updated through the table access method, the same way
+logical replication applies an UPDATE: RelationFindReplTupleByIndex() finds
+and locks the newest version of the row (retrying after concurrent
+updates) and ExecSimpleRelationUpdate() updates it and maintains the
+indexes. As in logical replication the executor state gets a range table
+and the destination as its result relation, which the foreign key triggers
+fired by the update look at.
+
+That skips everything the statement would check, so the direct path is only
+taken when none of it applies, and the caller falls back to SPI otherwise:
+
+  - the destination is a plain, unpartitioned table without row level
+    security, check constraints or generated columns
+  - its only triggers are foreign key triggers, which have nothing to do as
+    no key changes, and the timestamp column is not part of a unique index
+    or foreign key
+  - its primary key is a single btree column of exactly the type of the
+    source key, so no cross-type comparison is needed
+  - the timestamp column is a timestamp or timestamptz, the transaction
+    timestamp is rounded to its precision like the UPDATE would
+  - the user may SELECT and UPDATE the whole table (column privileges are
+    left to the statement)
+  - the transaction does not use a transaction snapshot: the newest
+    version of the row is updated, which only matches the semantics of READ
+    COMMITTED
+  - there is no `destination_where=`, which the UPDATE evaluates before
+    it locks the row, while the row would be locked here by the time it is
+    found (the plan does not use the direct path at all then)
+
+Those checks are done once and kept in the CtDirect of the plan until the
+relcache entry of the destination or any role is invalidated, or another
+user cascades. The first cascade of a statement opens the destination, its
+indexes and the executor state, and every further cascade to the same
+destination reuses them. They belong to the top transaction, so that
+subtransactions may come and go in between, and are closed when the
+top-level statement finishes. Cascades outside of any statement, from COPY
+or deferred triggers, keep them until the next utility statement or
+commit, as ALTER TABLE and the like refuse a table that is still open. A
+cascade that fails halfway has its state thrown away with the
+subtransaction.
+
+Requires PostgreSQL 14 or later, older versions always use SPI.
+
+With `storage=inplace` the row is not updated at all, the timestamp is
+overwritten in the existing tuple under the buffer lock and WAL logged,
+the way heap_inplace_update() does for VACUUM updating pg_class. No new row
+version, no index entries and no bloat, but the value is not rolled back
+with the transaction and concurrent transactions see it right away. It is
+only done for heap tables on which no index or expression covers the
+timestamp column, otherwise those would silently go stale, and the row is
+updated as above when it can not be done. The row is share locked rather
+than locked for update, so cascades to the same row only wait for the
+buffer lock of each other, while an UPDATE of the row still can not slip
+in between finding the tuple and overwriting it. That lock still stamps
+the xmax of the tuple, which is WAL logged and takes a multixact once
+several transactions share it, and it is held until commit: what is saved
+is the new row version and its index entries, not the WAL altogether.
+Whether the row can be overwritten, with its timestamp set and no column
+added since, is checked on an unlocked look-up first and a row that can
+not is locked for update right away. Two cascades holding the share lock
+could not both upgrade it to update the row. The timestamp on the page
+is compared under the same buffer lock, so a cascade never replaces a
+newer timestamp another one wrote in the meantime. The in-place update was
+reworked in PostgreSQL 18, which is not supported.
+*/
+
+#include "cascade_timestamp.h"
+
+#if PG_VERSION_NUM >= 140000
+
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/xact.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "parser/parse_relation.h"
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/heapam_xlog.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "access/xloginsert.h"
+#include "nodes/bitmapset.h"
+#include "storage/bufmgr.h"
+#include "tcop/utility.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+
+/* What a statement keeps open between its cascades to a destination */
+typedef struct CtDirectState {
+    Relation rel;
+    Relation index;
+    EState *estate;
+    ResultRelInfo *rri;
+    TupleTableSlot *searchslot;
+    TupleTableSlot *oldslot;
+    TupleTableSlot *newslot;
+    RegProcedure eqproc;    /* of the key, once looked up for storage=inplace */
+    bool busy;              /* a cascade is using it */
+    SubTransactionId subid; /* in which that cascade started */
+} CtDirectState;
+
+static dlist_head ct_directs = DLIST_STATIC_INIT(ct_directs);
+static int ct_direct_nesting = 0;
+
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ProcessUtility_hook_type prev_ProcessUtility = NULL;
+
+static CtDirectState *ct_direct_open(CtDirect *direct, Oid keytype);
+static void ct_direct_close(CtDirect *direct, bool failed);
+static void ct_direct_release_all(void);
+static void ct_direct_range_table(EState *estate, Relation rel,
+        AttrNumber tsattnum);
+static bool ct_direct_usable(CtDirect *direct, Relation rel, Oid keytype);
+static AttrNumber ct_direct_attnum(Relation rel, AttrNumber attnum,
+        const char *name);
+static Relation ct_direct_index(CtDirect *direct, ResultRelInfo *rri,
+        Relation rel);
+static bool ct_direct_inplace_usable(CtDirect *direct, Relation rel);
+static bool ct_direct_overwritable(CtDirect *direct, CtDirectState *state,
+        Datum kval);
+static bool ct_direct_overwrite(CtDirect *direct, Relation rel,
+        TupleTableSlot *oldslot, Datum ts);
+static void ct_direct_ExecutorFinish(QueryDesc *queryDesc);
+static void ct_direct_ProcessUtility(PlannedStmt *pstmt,
+        const char *queryString, bool readOnlyTree,
+        ProcessUtilityContext context, ParamListInfo params,
+        QueryEnvironment *queryEnv, DestReceiver *dest, QueryCompletion *qc);
+static void ct_direct_xact_callback(XactEvent event, void *arg);
+static void ct_direct_subxact_callback(SubXactEvent event,
+        SubTransactionId mySubid, SubTransactionId parentSubid, void *arg);
+static void ct_direct_relcache_callback(Datum arg, Oid relid);
+static void ct_direct_syscache_callback(Datum arg, int cacheid,
+        uint32 hashvalue);
+
+#endif
+
+void
+ct_direct_init(void){
+#if PG_VERSION_NUM >= 140000
+    prev_ExecutorFinish = ExecutorFinish_hook;
+    ExecutorFinish_hook = ct_direct_ExecutorFinish;
+    prev_ProcessUtility = ProcessUtility_hook;
+    ProcessUtility_hook = ct_direct_ProcessUtility;
+    RegisterXactCallback(ct_direct_xact_callback, NULL);
+    RegisterSubXactCallback(ct_direct_subxact_callback, NULL);
+    CacheRegisterRelcacheCallback(ct_direct_relcache_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(AUTHOID, ct_direct_syscache_callback,
+            (Datum) 0);
+    CacheRegisterSyscacheCallback(AUTHMEMROLEMEM, ct_direct_syscache_callback,
+            (Datum) 0);
+#endif
+}
+
+/* Close what the plan has open, before it is freed */
+void
+ct_direct_release(CtDirect *direct){
+#if PG_VERSION_NUM >= 140000
+    if(direct->state != NULL)
+        ct_direct_close(direct, false);
+    if(direct->registered){
+        dlist_delete(&direct->node);
+        direct->registered = false;
+    }
+#endif
+}
+
+/*
+ * Set the timestamp of the destination row with this key. Returns false if
+ * the direct path does not apply, *processed is the number of rows updated
+ * otherwise.
+ */
+bool
+ct_direct_update(CtDirect *direct, Oid keytype, Datum kval,
+        uint64 *processed){
+#if PG_VERSION_NUM >= 140000
+    CtDirectState *state;
+    Relation rel;
+    EState *estate;
+    TupleTableSlot *searchslot, *oldslot, *newslot;
+    MemoryContext oldcontext;
+    TimestampTz now;
+    Form_pg_attribute tsattr;
+    Datum ts;
+    LockTupleMode lockmode;
+    int natts;
+    bool found;
+
+    if(IsolationUsesXactSnapshot())
+        return false;
+
+    if(!direct->registered){
+        dlist_push_tail(&ct_directs, &direct->node);
+        direct->registered = true;
+    }
+
+    if(direct->checked && (direct->checkeduser != GetUserId() ||
+                direct->checkedkeytype != keytype))
+        direct->checked = false;
+
+    /* Nested in a cascade to the same destination, which uses the slots */
+    state = direct->state;
+    if(state != NULL && state->busy)
+        return false;
+
+    if(state != NULL && !direct->checked){
+        ct_direct_close(direct, false);
+        state = NULL;
+    }
+    if(direct->checked && !direct->usable)
+        return false;
+    if(state == NULL){
+        state = ct_direct_open(direct, keytype);
+        if(state == NULL)
+            return false;
+    }
+
+    rel = state->rel;
+    estate = state->estate;
+    searchslot = state->searchslot;
+    oldslot = state->oldslot;
+    newslot = state->newslot;
+    natts = RelationGetDescr(rel)->natts;
+
+    state->busy = true;
+    state->subid = GetCurrentSubTransactionId();
+    oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+
+    /* Like SPI: see what earlier cascades of this statement did */
+    CommandCounterIncrement();
+    estate->es_output_cid = GetCurrentCommandId(true);
+    estate->es_snapshot = GetActiveSnapshot();
+    AfterTriggerBeginQuery();
+
+    ExecClearTuple(searchslot);
+    memset(searchslot->tts_isnull, true, natts * sizeof(bool));
+    searchslot->tts_values[direct->keyattnum - 1] = kval;
+    searchslot->tts_isnull[direct->keyattnum - 1] = false;
+    ExecStoreVirtualTuple(searchslot);
+
+    /* A FOR NO KEY UPDATE lock like the UPDATE would take, or FOR SHARE */
+    lockmode = LockTupleNoKeyExclusive;
+    if(direct->overwrite && ct_direct_overwritable(direct, state, kval))
+        lockmode = LockTupleShare;
+    found = RelationFindReplTupleByIndex(rel, RelationGetRelid(state->index),
+            lockmode, searchslot, oldslot);
+    if(found){
+        tsattr = TupleDescAttr(RelationGetDescr(rel), direct->tsattnum - 1);
+        now = GetCurrentTransactionStartTimestamp();
+        if(tsattr->atttypid == TIMESTAMPOID)
+            ts = DirectFunctionCall1(timestamptz_timestamp,
+                    TimestampTzGetDatum(now));
+        else
+            ts = TimestampTzGetDatum(now);
+
+        /* Rounded to the precision of the column, like the UPDATE assigns */
+        if(tsattr->atttypmod >= 0 && tsattr->atttypid == TIMESTAMPOID)
+            ts = DirectFunctionCall2(timestamp_scale, ts,
+                    Int32GetDatum(tsattr->atttypmod));
+        else if(tsattr->atttypmod >= 0)
+            ts = DirectFunctionCall2(timestamptz_scale, ts,
+                    Int32GetDatum(tsattr->atttypmod));
+
+        slot_getallattrs(oldslot);
+    }
+
+    if(found && !(lockmode == LockTupleShare &&
+                ct_direct_overwrite(direct, rel, oldslot, ts))){
+        ExecClearTuple(newslot);
+        memcpy(newslot->tts_values, oldslot->tts_values,
+                natts * sizeof(Datum));
+        memcpy(newslot->tts_isnull, oldslot->tts_isnull,
+                natts * sizeof(bool));
+        newslot->tts_values[direct->tsattnum - 1] = ts;
+        newslot->tts_isnull[direct->tsattnum - 1] = false;
+        ExecStoreVirtualTuple(newslot);
+
+        /* There are no BEFORE triggers, so no EvalPlanQual either */
+        ExecSimpleRelationUpdate(state->rri, estate, NULL, oldslot, newslot);
+    }
+
+    AfterTriggerEndQuery(estate);
+
+    /* No buffer stays pinned until the next cascade */
+    ExecClearTuple(searchslot);
+    ExecClearTuple(oldslot);
+    ExecClearTuple(newslot);
+    MemoryContextSwitchTo(oldcontext);
+    ResetPerTupleExprContext(estate);
+    state->busy = false;
+
+    *processed = found ? 1 : 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if PG_VERSION_NUM >= 140000
+
+/*
+ * Open the destination, its indexes and an executor state for the rest of
+ * the statement, checking first whether the direct path applies unless
+ * that is known. NULL if it does not.
+ */
+static CtDirectState *
+ct_direct_open(CtDirect *direct, Oid keytype){
+    ResourceOwner oldowner = CurrentResourceOwner;
+    MemoryContext oldcontext;
+    CtDirectState *state;
+    Relation rel;
+    Relation index = NULL;
+    EState *estate;
+    ResultRelInfo *rri = NULL;
+    bool usable;
+
+    /* Owned by the top transaction, see ct_direct_subxact_callback() */
+    CurrentResourceOwner = TopTransactionResourceOwner;
+    oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+    rel = table_open(direct->destination, RowExclusiveLock);
+    estate = CreateExecutorState();
+    MemoryContextSwitchTo(estate->es_query_cxt);
+
+    usable = direct->checked || ct_direct_usable(direct, rel, keytype);
+    if(usable){
+        ct_direct_range_table(estate, rel, direct->tsattnum);
+
+        rri = makeNode(ResultRelInfo);
+        InitResultRelInfo(rri, rel, 1, NULL, 0);
+        /* So that the triggers fired by the update find it */
+        estate->es_opened_result_relations =
+            lappend(estate->es_opened_result_relations, rri);
+        ExecOpenIndices(rri, false);
+
+        index = ct_direct_index(direct, rri, rel);
+        usable = (index != NULL);
+    }
+
+    if(!direct->checked){
+        direct->checked = true;
+        direct->checkeduser = GetUserId();
+        direct->checkedkeytype = keytype;
+        direct->overwrite = usable && direct->inplace &&
+            ct_direct_inplace_usable(direct, rel);
+    }
+    direct->usable = usable;
+
+    if(!usable){
+        if(rri != NULL)
+            ExecCloseIndices(rri);
+        MemoryContextSwitchTo(oldcontext);
+        FreeExecutorState(estate);
+        table_close(rel, RowExclusiveLock);
+        CurrentResourceOwner = oldowner;
+        return NULL;
+    }
+
+    state = (CtDirectState *) palloc0(sizeof(CtDirectState));
+    state->rel = rel;
+    state->index = index;
+    state->estate = estate;
+    state->rri = rri;
+    state->searchslot = table_slot_create(rel, &estate->es_tupleTable);
+    state->oldslot = table_slot_create(rel, &estate->es_tupleTable);
+    state->newslot = table_slot_create(rel, &estate->es_tupleTable);
+    direct->state = state;
+
+    MemoryContextSwitchTo(oldcontext);
+    CurrentResourceOwner = oldowner;
+    return state;
+}
+
+/*
+ * Close what ct_direct_open() opened, keeping the lock until the end of the
+ * transaction like the UPDATE. A cascade that failed may have left buffers
+ * pinned in its slots, those pins go with its subtransaction.
+ */
+static void
+ct_direct_close(CtDirect *direct, bool failed){
+    CtDirectState *state = direct->state;
+    EState *estate = state->estate;
+    ResourceOwner oldowner = CurrentResourceOwner;
+
+    direct->state = NULL;
+
+    CurrentResourceOwner = TopTransactionResourceOwner;
+    ExecCloseIndices(state->rri);
+    table_close(state->rel, NoLock);
+    CurrentResourceOwner = oldowner;
+
+    if(failed){
+        MemoryContextDelete(estate->es_query_cxt);
+    }else{
+        ExecResetTupleTable(estate->es_tupleTable, false);
+        FreeExecutorState(estate);
+    }
+}
+
+/* Close everything that is not in use at the end of a statement */
+static void
+ct_direct_release_all(void){
+    dlist_iter iter;
+    CtDirect *direct;
+
+    dlist_foreach(iter, &ct_directs){
+        direct = dlist_container(CtDirect, node, iter.cur);
+        if(direct->state != NULL && !direct->state->busy)
+            ct_direct_close(direct, false);
+    }
+}
+
+/*
+ * The range table of the update, the destination with the timestamp column
+ * updated, like logical replication builds it.
+ */
+static void
+ct_direct_range_table(EState *estate, Relation rel, AttrNumber tsattnum){
+    RangeTblEntry *rte = makeNode(RangeTblEntry);
+#if PG_VERSION_NUM >= 160000
+    RTEPermissionInfo *perminfo;
+    List *perminfos = NIL;
+#endif
+
+    rte->rtekind = RTE_RELATION;
+    rte->relid = RelationGetRelid(rel);
+    rte->relkind = rel->rd_rel->relkind;
+    rte->rellockmode = RowExclusiveLock;
+
+#if PG_VERSION_NUM >= 160000
+    perminfo = addRTEPermissionInfo(&perminfos, rte);
+    perminfo->requiredPerms = ACL_SELECT | ACL_UPDATE;
+    perminfo->updatedCols = bms_make_singleton(tsattnum -
+            FirstLowInvalidHeapAttributeNumber);
+#else
+    rte->requiredPerms = ACL_SELECT | ACL_UPDATE;
+    rte->updatedCols = bms_make_singleton(tsattnum -
+            FirstLowInvalidHeapAttributeNumber);
+#endif
+
+#if PG_VERSION_NUM >= 180000
+    ExecInitRangeTable(estate, list_make1(rte), perminfos,
+            bms_make_singleton(1));
+#elif PG_VERSION_NUM >= 160000
+    ExecInitRangeTable(estate, list_make1(rte), perminfos);
+#else
+    ExecInitRangeTable(estate, list_make1(rte));
+#endif
+}
+
+/* Everything but the index, which is checked once the indexes are open */
+static bool
+ct_direct_usable(CtDirect *direct, Relation rel, Oid keytype){
+    TupleConstr *constr = RelationGetDescr(rel)->constr;
+    TriggerDesc *trigdesc = rel->trigdesc;
+    List *fkeys;
+    ListCell *lc;
+    Oid tstype;
+    int i;
+
+    if(rel->rd_rel->relkind != RELKIND_RELATION ||
+            rel->rd_rel->relispartition || rel->rd_rel->relrowsecurity)
+        return false;
+
+    if(constr != NULL && (constr->num_check > 0 || constr->has_generated_stored))
+        return false;
+
+    if(trigdesc != NULL){
+        for(i = 0; i < trigdesc->numtriggers; i++){
+            if(RI_FKey_trigger_type(trigdesc->triggers[i].tgfoid) ==
+                    RI_TRIGGER_NONE)
+                return false;
+        }
+    }
+
+    direct->keyattnum = ct_direct_attnum(rel, direct->keyattnum,
+            direct->keycolumn);
+    direct->tsattnum = ct_direct_attnum(rel, direct->tsattnum,
+            direct->tscolumn);
+    if(direct->keyattnum == InvalidAttrNumber ||
+            direct->tsattnum == InvalidAttrNumber)
+        return false;
+
+    if(TupleDescAttr(RelationGetDescr(rel),
+                direct->keyattnum - 1)->atttypid != keytype)
+        return false;
+
+    tstype = TupleDescAttr(RelationGetDescr(rel),
+            direct->tsattnum - 1)->atttypid;
+    if(tstype != TIMESTAMPTZOID && tstype != TIMESTAMPOID)
+        return false;
+
+    fkeys = RelationGetFKeyList(rel);
+    foreach(lc, fkeys){
+        ForeignKeyCacheInfo *fkey = (ForeignKeyCacheInfo *) lfirst(lc);
+
+        for(i = 0; i < fkey->nkeys; i++){
+            if(fkey->conkey[i] == direct->tsattnum)
+                return false;
+        }
+    }
+
+    if(pg_class_aclcheck(RelationGetRelid(rel), GetUserId(), ACL_UPDATE) !=
+            ACLCHECK_OK ||
+            pg_class_aclcheck(RelationGetRelid(rel), GetUserId(), ACL_SELECT) !=
+            ACLCHECK_OK)
+        return false;
+
+    return true;
+}
+
+/*
+ * The number of the named column, reusing the cached one while it still
+ * has that name. InvalidAttrNumber if there is no such column.
+ */
+static AttrNumber
+ct_direct_attnum(Relation rel, AttrNumber attnum, const char *name){
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    Form_pg_attribute attr;
+
+    if(attnum > 0 && attnum <= tupdesc->natts){
+        attr = TupleDescAttr(tupdesc, attnum - 1);
+        if(!attr->attisdropped && strcmp(NameStr(attr->attname), name) == 0)
+            return attnum;
+    }
+
+    attnum = attnameAttNum(rel, name, false);
+    return attnum > 0 ? attnum : InvalidAttrNumber;
+}
+
+/*
+ * The open primary key index if it is a single btree column on the key,
+ * NULL otherwise. Also makes sure no unique index covers the timestamp
+ * column.
+ */
+static Relation
+ct_direct_index(CtDirect *direct, ResultRelInfo *rri, Relation rel){
+    Relation index;
+    Relation pkey = NULL;
+    Form_pg_index indexform;
+    Oid pkoid;
+    int i, j;
+
+    /* rd_pkindex is only valid once the index list has been loaded */
+    if(!rel->rd_indexvalid)
+        list_free(RelationGetIndexList(rel));
+    pkoid = rel->rd_pkindex;
+    if(!OidIsValid(pkoid))
+        return NULL;
+
+    for(i = 0; i < rri->ri_NumIndices; i++){
+        index = rri->ri_IndexRelationDescs[i];
+        indexform = index->rd_index;
+
+        if(RelationGetRelid(index) == pkoid){
+            if(index->rd_rel->relam == BTREE_AM_OID &&
+                    indexform->indnkeyatts == 1 &&
+                    indexform->indkey.values[0] == direct->keyattnum)
+                pkey = index;
+        }
+
+        if(indexform->indisunique){
+            for(j = 0; j < indexform->indnatts; j++){
+                if(indexform->indkey.values[j] == direct->tsattnum)
+                    return NULL;
+            }
+        }
+    }
+
+    return pkey;
+}
+
+/*
+ * Whether the timestamp can be overwritten in place: a heap table on which
+ * no index, index expression or index predicate uses the timestamp column.
+ */
+static bool
+ct_direct_inplace_usable(CtDirect *direct, Relation rel){
+#if PG_VERSION_NUM < 180000
+    Bitmapset *indexed;
+    bool usable;
+
+    if(rel->rd_tableam != GetHeapamTableAmRoutine())
+        return false;
+
+#if PG_VERSION_NUM >= 160000
+    indexed = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_HOT_BLOCKING);
+#else
+    indexed = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_ALL);
+#endif
+    usable = !bms_is_member(direct->tsattnum -
+            FirstLowInvalidHeapAttributeNumber, indexed);
+    bms_free(indexed);
+    return usable;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Whether the row with this key can be overwritten in place as it is now,
+ * looked up through the index without locking it: the timestamp is set and
+ * the tuple has every column. Should it change before the row is locked
+ * the overwrite still declines and the row is updated under the share lock.
+ */
+static bool
+ct_direct_overwritable(CtDirect *direct, CtDirectState *state, Datum kval){
+#if PG_VERSION_NUM < 180000
+    Relation rel = state->rel;
+    Relation index = state->index;
+    TupleTableSlot *slot = state->oldslot;
+    ScanKeyData skey;
+    IndexScanDesc scan;
+    HeapTuple tuple;
+    Oid eqop;
+    bool overwritable = false;
+    bool shouldfree;
+    bool isnull;
+
+    if(!OidIsValid(state->eqproc)){
+        eqop = get_opfamily_member(index->rd_opfamily[0],
+                index->rd_opcintype[0], index->rd_opcintype[0],
+                BTEqualStrategyNumber);
+        if(!OidIsValid(eqop))
+            elog(ERROR, "cascade_timestamp: no equality operator for the primary key of \"%s\"",
+                    RelationGetRelationName(rel));
+        state->eqproc = get_opcode(eqop);
+    }
+
+    ScanKeyInit(&skey, 1, BTEqualStrategyNumber, state->eqproc, kval);
+    skey.sk_collation = index->rd_indcollation[0];
+
+    scan = index_beginscan(rel, index, GetLatestSnapshot(), 1, 0);
+    index_rescan(scan, &skey, 1, NULL, 0);
+    if(index_getnext_slot(scan, ForwardScanDirection, slot)){
+        (void) slot_getattr(slot, direct->tsattnum, &isnull);
+        tuple = ExecFetchSlotHeapTuple(slot, false, &shouldfree);
+        overwritable = !isnull && HeapTupleHeaderGetNatts(tuple->t_data) >=
+            RelationGetDescr(rel)->natts;
+        if(shouldfree)
+            heap_freetuple(tuple);
+    }
+    index_endscan(scan);
+    ExecClearTuple(slot);
+
+    return overwritable;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Overwrite the timestamp of the locked tuple in oldslot, doing what
+ * heap_inplace_update() does but comparing with the timestamp on the page
+ * first, under the same buffer lock. The row is only share locked, so
+ * concurrent cascades to it get here at the same time and only the buffer
+ * lock orders their overwrites. Returns false if the new tuple would not
+ * have the same length, when the timestamp is NULL or the tuple predates a
+ * column added since.
+ */
+static bool
+ct_direct_overwrite(CtDirect *direct, Relation rel, TupleTableSlot *oldslot,
+        Datum ts){
+#if PG_VERSION_NUM < 180000
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    ItemPointerData tid = oldslot->tts_tid;
+    OffsetNumber offnum = ItemPointerGetOffsetNumber(&tid);
+    HeapTupleData oldtup;
+    HeapTuple newtup;
+    Buffer buffer;
+    Page page;
+    ItemId lp = NULL;
+    Datum current;
+    bool isnull = false;
+    int attnum = direct->tsattnum;
+    uint32 newlen;
+
+    buffer = ReadBuffer(rel, ItemPointerGetBlockNumber(&tid));
+    LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+    page = BufferGetPage(buffer);
+
+    if(PageGetMaxOffsetNumber(page) >= offnum)
+        lp = PageGetItemId(page, offnum);
+    if(lp == NULL || !ItemIdIsNormal(lp))
+        elog(ERROR, "cascade_timestamp: invalid lp");
+
+    oldtup.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+    oldtup.t_len = ItemIdGetLength(lp);
+    oldtup.t_self = tid;
+    oldtup.t_tableOid = RelationGetRelid(rel);
+
+    if(HeapTupleHeaderGetNatts(oldtup.t_data) < tupdesc->natts){
+        UnlockReleaseBuffer(buffer);
+        return false;
+    }
+
+    current = heap_getattr(&oldtup, attnum, tupdesc, &isnull);
+    if(isnull){
+        UnlockReleaseBuffer(buffer);
+        return false;
+    }
+
+    /* Never move the timestamp back */
+    if(DatumGetInt64(current) >= DatumGetInt64(ts)){
+        UnlockReleaseBuffer(buffer);
+        return true;
+    }
+
+    newtup = heap_modify_tuple_by_cols(&oldtup, tupdesc, 1, &attnum, &ts,
+            &isnull);
+    if(newtup->t_len != oldtup.t_len ||
+            newtup->t_data->t_hoff != oldtup.t_data->t_hoff){
+        UnlockReleaseBuffer(buffer);
+        heap_freetuple(newtup);
+        return false;
+    }
+    newlen = newtup->t_len - newtup->t_data->t_hoff;
+
+    START_CRIT_SECTION();
+
+    memcpy((char *) oldtup.t_data + oldtup.t_data->t_hoff,
+            (char *) newtup->t_data + newtup->t_data->t_hoff, newlen);
+    MarkBufferDirty(buffer);
+
+    /* The record heap_inplace_update() writes */
+    if(RelationNeedsWAL(rel)){
+        xl_heap_inplace xlrec;
+        XLogRecPtr recptr;
+
+        xlrec.offnum = offnum;
+
+        XLogBeginInsert();
+        XLogRegisterData((char *) &xlrec, SizeOfHeapInplace);
+        XLogRegisterBuffer(0, buffer, REGBUF_STANDARD);
+        XLogRegisterBufData(0, (char *) oldtup.t_data + oldtup.t_data->t_hoff,
+                newlen);
+        recptr = XLogInsert(RM_HEAP_ID, XLOG_HEAP_INPLACE);
+        PageSetLSN(page, recptr);
+    }
+
+    END_CRIT_SECTION();
+
+    UnlockReleaseBuffer(buffer);
+    heap_freetuple(newtup);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * The row triggers of a statement fire in its ExecutorFinish, once that of
+ * the top-level statement is done the destinations can be closed.
+ */
+static void
+ct_direct_ExecutorFinish(QueryDesc *queryDesc){
+    ct_direct_nesting++;
+    PG_TRY();
+    {
+        if(prev_ExecutorFinish)
+            prev_ExecutorFinish(queryDesc);
+        else
+            standard_ExecutorFinish(queryDesc);
+    }
+    PG_CATCH();
+    {
+        ct_direct_nesting--;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    ct_direct_nesting--;
+
+    if(ct_direct_nesting == 0)
+        ct_direct_release_all();
+}
+
+/* ALTER TABLE, TRUNCATE and the like refuse a table that is still open */
+static void
+ct_direct_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+        bool readOnlyTree, ProcessUtilityContext context,
+        ParamListInfo params, QueryEnvironment *queryEnv,
+        DestReceiver *dest, QueryCompletion *qc){
+    ct_direct_release_all();
+
+    if(prev_ProcessUtility)
+        prev_ProcessUtility(pstmt, queryString, readOnlyTree, context, params,
+                queryEnv, dest, qc);
+    else
+        standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+                params, queryEnv, dest, qc);
+}
+
+/*
+ * Deferred triggers have fired by pre-commit. An aborted transaction
+ * releases everything itself.
+ */
+static void
+ct_direct_xact_callback(XactEvent event, void *arg){
+    dlist_iter iter;
+
+    switch(event){
+        case XACT_EVENT_PRE_COMMIT:
+        case XACT_EVENT_PRE_PREPARE:
+            ct_direct_release_all();
+            break;
+        case XACT_EVENT_ABORT:
+            dlist_foreach(iter, &ct_directs)
+                dlist_container(CtDirect, node, iter.cur)->state = NULL;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Throw away the state of the cascades the subtransaction interrupted */
+static void
+ct_direct_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+        SubTransactionId parentSubid, void *arg){
+    dlist_iter iter;
+    CtDirect *direct;
+
+    if(event != SUBXACT_EVENT_ABORT_SUB)
+        return;
+
+    dlist_foreach(iter, &ct_directs){
+        direct = dlist_container(CtDirect, node, iter.cur);
+        if(direct->state != NULL && direct->state->busy &&
+                direct->state->subid >= mySubid)
+            ct_direct_close(direct, true);
+    }
+}
+
+/* Trigger, constraint, index and privilege changes of the destination */
+static void
+ct_direct_relcache_callback(Datum arg, Oid relid){
+    dlist_iter iter;
+    CtDirect *direct;
+
+    dlist_foreach(iter, &ct_directs){
+        direct = dlist_container(CtDirect, node, iter.cur);
+        if(relid == InvalidOid || relid == direct->destination)
+            direct->checked = false;
+    }
+}
+
+/* Role and membership changes, which decide the privileges */
+static void
+ct_direct_syscache_callback(Datum arg, int cacheid, uint32 hashvalue){
+    dlist_iter iter;
+
+    dlist_foreach(iter, &ct_directs)
+        dlist_container(CtDirect, node, iter.cur)->checked = false;
+}
+
+#endif
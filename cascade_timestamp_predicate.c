@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Compiled row predicates, for `where=<expression>`.
+
+The expression is parsed and analyzed against the table like the WHEN
+condition of a trigger: it can use the columns of the row, operators and
+functions, but no subqueries or aggregates. It is planned with
+expression_planner() (constant folding, inlining of SQL functions) and
+compiled into an executor expression once. Rows are checked with ExecQual()
+in a standalone expression context against their slot as it is, so nothing
+is converted to text, and the per-tuple memory of the expression is reset
+right away. A NULL result rejects the row, like WHEN does.
+
+A compiled predicate depends on the table and on the functions it calls.
+Every predicate of the backend is kept in a list, and is marked stale when
+the relcache entry of its table or any function is invalidated; the owner
+compiles it again.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "executor/executor.h"
+#include "lib/ilist.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_clause.h"
+#include "parser/parse_collate.h"
+#include "parser/parse_node.h"
+#include "parser/parse_relation.h"
+#include "parser/parser.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+
+struct CtPredicate {
+    dlist_node node;
+    MemoryContext context;  /* holds the predicate and its expression */
+    Oid relid;
+    bool stale;
+    ExprState *state;
+    ExprContext *econtext;
+};
+
+static dlist_head ct_predicates = DLIST_STATIC_INIT(ct_predicates);
+
+static Node *ct_predicate_parse(const char *sql, const char *source);
+static void ct_predicate_relcache_callback(Datum arg, Oid relid);
+static void ct_predicate_syscache_callback(Datum arg, int cacheid,
+        uint32 hashvalue);
+
+void
+ct_predicate_init(void){
+    CacheRegisterRelcacheCallback(ct_predicate_relcache_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(PROCOID, ct_predicate_syscache_callback,
+            (Datum) 0);
+}
+
+/*
+ * Compile `source`, a boolean expression over the columns of `rel`, in a
+ * child context of `context`.
+ */
+CtPredicate *
+ct_predicate_compile(MemoryContext context, Relation rel, const char *source){
+    MemoryContext predcontext, oldcontext;
+    CtPredicate *pred;
+    ParseState *pstate;
+#if PG_VERSION_NUM >= 130000
+    ParseNamespaceItem *nsitem;
+#else
+    RangeTblEntry *rte;
+#endif
+    Node *clause;
+    Expr *expr;
+    char *sql;
+
+    predcontext = AllocSetContextCreate(context,
+            "cascade_timestamp predicate", ALLOCSET_SMALL_SIZES);
+    oldcontext = MemoryContextSwitchTo(predcontext);
+
+    sql = psprintf("SELECT %s", source);
+    pstate = make_parsestate(NULL);
+    pstate->p_sourcetext = sql;
+#if PG_VERSION_NUM >= 130000
+    nsitem = addRangeTableEntryForRelation(pstate, rel, AccessShareLock,
+            NULL, false, false);
+    addNSItemToQuery(pstate, nsitem, false, true, true);
+#else
+    rte = addRangeTableEntryForRelation(pstate, rel, AccessShareLock,
+            NULL, false, false);
+    addRTEtoQuery(pstate, rte, false, true, true);
+#endif
+
+    clause = transformWhereClause(pstate, ct_predicate_parse(sql, source),
+            EXPR_KIND_TRIGGER_WHEN, "WHERE");
+    assign_expr_collations(pstate, clause);
+    free_parsestate(pstate);
+
+    expr = expression_planner((Expr *) clause);
+
+    pred = (CtPredicate *)palloc0(sizeof(CtPredicate));
+    pred->context = predcontext;
+    pred->relid = RelationGetRelid(rel);
+    pred->stale = false;
+    pred->state = ExecInitQual(make_ands_implicit(expr), NULL);
+    pred->econtext = CreateStandaloneExprContext();
+    MemoryContextSwitchTo(oldcontext);
+
+    dlist_push_tail(&ct_predicates, &pred->node);
+    return pred;
+}
+
+/* Whether the row in `slot` satisfies the predicate, NULL does not */
+bool
+ct_predicate_matches(CtPredicate *pred, TupleTableSlot *slot){
+    bool result;
+
+    pred->econtext->ecxt_scantuple = slot;
+    result = ExecQual(pred->state, pred->econtext);
+    ResetExprContext(pred->econtext);
+
+    return result;
+}
+
+/* Whether the predicate has to be compiled again before it is used */
+bool
+ct_predicate_stale(CtPredicate *pred){
+    return pred->stale;
+}
+
+void
+ct_predicate_free(CtPredicate *pred){
+    dlist_delete(&pred->node);
+    MemoryContextDelete(pred->context);
+}
+
+/* The expression of `SELECT <source>`, which has to be all there is */
+static Node *
+ct_predicate_parse(const char *sql, const char *source){
+    List *raw;
+    SelectStmt *stmt;
+    ResTarget *target;
+
+#if PG_VERSION_NUM >= 140000
+    raw = raw_parser(sql, RAW_PARSE_DEFAULT);
+#else
+    raw = raw_parser(sql);
+#endif
+    if(list_length(raw) == 1){
+        stmt = (SelectStmt *) ((RawStmt *) linitial(raw))->stmt;
+        if(IsA(stmt, SelectStmt) && stmt->op == SETOP_NONE &&
+                list_length(stmt->targetList) == 1 &&
+                stmt->distinctClause == NIL && stmt->intoClause == NULL &&
+                stmt->fromClause == NIL && stmt->whereClause == NULL &&
+                stmt->groupClause == NIL && stmt->havingClause == NULL &&
+                stmt->windowClause == NIL && stmt->valuesLists == NIL &&
+                stmt->sortClause == NIL && stmt->limitOffset == NULL &&
+                stmt->limitCount == NULL && stmt->lockingClause == NIL &&
+                stmt->withClause == NULL){
+            target = linitial_node(ResTarget, stmt->targetList);
+            if(target->name == NULL)
+                return target->val;
+        }
+    }
+
+    elog(ERROR, "cascade_timestamp: \"%s\" is not a single expression",
+            source);
+    return NULL;    /* keep compiler quiet */
+}
+
+static void
+ct_predicate_relcache_callback(Datum arg, Oid relid){
+    dlist_iter iter;
+    CtPredicate *pred;
+
+    dlist_foreach(iter, &ct_predicates){
+        pred = dlist_container(CtPredicate, node, iter.cur);
+        if(!OidIsValid(relid) || pred->relid == relid)
+            pred->stale = true;
+    }
+}
+
+static void
+ct_predicate_syscache_callback(Datum arg, int cacheid, uint32 hashvalue){
+    dlist_iter iter;
+
+    dlist_foreach(iter, &ct_predicates){
+        dlist_container(CtPredicate, node, iter.cur)->stale = true;
+    }
+}
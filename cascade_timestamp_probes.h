@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Static tracing probes of the cascade_timestamp trigger, following the
+TRACE_POSTGRESQL_* probes of the server. They are only compiled in when the
+server was configured with --enable-dtrace (ENABLE_DTRACE in pg_config.h),
+as SystemTap SDT probes usable by bpftrace, perf and stap. Like the server's
+they are generated from a probes file, cascade_timestamp_probes.d, by
+`dtrace -h`. Otherwise the macros expand to nothing and their arguments are
+not evaluated.
+
+Provider `cascade_timestamp`:
+
+    trigger__start(trigger oid)                 every invocation
+    trigger__noop(trigger oid)                  UPDATE without changes
+    trigger__filtered(trigger oid)              rejected by the filters
+    plan__miss(trigger oid)                     destination statement prepared
+    update__start(trigger oid, key hash)        before the destination statement
+    update__done(trigger oid, key hash, rows)   after the destination statement
+
+The key hash is hash_any() of the key text, the same for every type of key.
+Computing it renders the key, so callers only do that when
+TRACE_CASCADE_TIMESTAMP_UPDATE_START_ENABLED() or
+TRACE_CASCADE_TIMESTAMP_UPDATE_DONE_ENABLED() says a tracer is attached.
+*/
+
+#ifndef CASCADE_TIMESTAMP_PROBES_H
+#define CASCADE_TIMESTAMP_PROBES_H
+
+#ifdef ENABLE_DTRACE
+
+#include "cascade_timestamp_probes_dtrace.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#else
+#include "utils/hashutils.h"
+#endif
+
+#define CT_KEY_HASH(key) \
+    DatumGetUInt32(hash_any((const unsigned char *) (key), strlen(key)))
+
+#else
+
+#define CT_KEY_HASH(key) (0)
+
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_START(trigger) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_START_ENABLED() (0)
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_NOOP(trigger) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_NOOP_ENABLED() (0)
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_FILTERED(trigger) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_TRIGGER_FILTERED_ENABLED() (0)
+#define TRACE_CASCADE_TIMESTAMP_PLAN_MISS(trigger) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_PLAN_MISS_ENABLED() (0)
+#define TRACE_CASCADE_TIMESTAMP_UPDATE_START(trigger, keyhash) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_UPDATE_START_ENABLED() (0)
+#define TRACE_CASCADE_TIMESTAMP_UPDATE_DONE(trigger, keyhash, rows) \
+    do {} while (0)
+#define TRACE_CASCADE_TIMESTAMP_UPDATE_DONE_ENABLED() (0)
+
+#endif
+
+#endif
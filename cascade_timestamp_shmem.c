@@ -0,0 +1,849 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Shared-memory last-modified map used by `storage=shmem`.
+
+The trigger stores `(database, destination, key) -> timestamp` in a fixed-size
+shared hash table instead of updating the destination row. A background
+worker periodically writes the dirty entries back to the destination table
+in one UPDATE per destination, and evicts clean entries when the table fills
+up. Reads go through `cascade_timestamp_get()`, which falls back to the
+destination table on a miss (e.g. after a restart).
+
+The map is split into CT_MAP_PARTITIONS independent hash tables, each with
+its own lock, picked by the top bits of the key's hash code. The worker
+copies out and evicts one partition at a time, so a trigger only ever waits
+for the partition of its own key. The worker connects to
+`cascade_timestamp.database` only, so `storage=shmem` is refused elsewhere.
+
+The same map memoizes the effective timestamps of `storage=lazy`
+destinations. Those entries are never dirty. The trigger turns them into
+tombstones that remember the generation of their last invalidation, so a
+concurrent reader can't store a value computed before it, while the other
+keys of the partition can still be memoized. Evicted tombstones raise the
+horizon of their partition, which then applies to every key without an entry.
+
+Requires `shared_preload_libraries = 'cascade_timestamp'`.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+
+#define CT_MAP_TRANCHE          "cascade_timestamp_map"
+#define CT_MAP_PARTITION_BITS   4
+#define CT_MAP_PARTITIONS       (1 << CT_MAP_PARTITION_BITS)
+#define CT_MAX_DESTINATIONS     64
+#define CT_FLUSH_BATCH          10000
+
+typedef struct {
+    Oid dboid;
+    Oid destination;
+    char key[CT_MAX_KEY_LEN];
+} CtMapKey;
+
+typedef struct {
+    CtMapKey key;
+    TimestampTz ts;
+    bool dirty;     /* ts has not been written to the destination yet */
+    bool tombstone; /* invalidated, there is no ts */
+    uint64 invalidated;     /* generation of the last invalidation */
+} CtMapEntry;
+
+/* Everything the worker needs to write a destination's entries back */
+typedef struct {
+    Oid dboid;
+    Oid destination;
+    Oid keytype;
+    char tscolumn[NAMEDATALEN];
+    char keycolumn[NAMEDATALEN];
+} CtDestination;
+
+typedef struct {
+    LWLockPadded *locks;    /* [0] destinations, [1..] map partitions */
+    uint64 generations[CT_MAP_PARTITIONS];  /* bumped by every invalidation */
+    uint64 horizons[CT_MAP_PARTITIONS];     /* of the evicted tombstones */
+    int ndestinations;
+    CtDestination destinations[CT_MAX_DESTINATIONS];
+} CtMapShared;
+
+typedef struct {
+    CtMapKey key;
+    TimestampTz ts;
+} CtFlushItem;
+
+extern Datum cascade_timestamp_shmem_get(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_memo_generation(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_memo_set(PG_FUNCTION_ARGS);
+
+static CtMapShared *ct_shared = NULL;
+static HTAB *ct_maps[CT_MAP_PARTITIONS];
+
+static int ct_map_entries = 65536;
+static int ct_map_interval = 1000;
+
+char *ct_map_database = NULL;
+
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+static bool ct_map_key(CtMapKey *mkey, Oid destination, const char *key);
+static HTAB *ct_map_partition(const CtMapKey *mkey, uint32 *hashcode,
+        int *partition);
+static long ct_map_partition_entries(void);
+static CtMapEntry *ct_map_enter(HTAB *map, const CtMapKey *mkey,
+        uint32 hashcode, bool *found);
+static bool ct_map_flush(void);
+static void ct_map_evict(void);
+static void ct_map_write(CtDestination *dest, CtFlushItem *items, int nitems);
+static bool ct_map_write_guarded(CtDestination *dest, CtFlushItem *items,
+        int nitems);
+static bool ct_map_destination(Oid destination, CtDestination *dest);
+static int ct_flush_item_cmp(const void *a, const void *b);
+
+PG_FUNCTION_INFO_V1(cascade_timestamp_shmem_get);
+PG_FUNCTION_INFO_V1(cascade_timestamp_memo_generation);
+PG_FUNCTION_INFO_V1(cascade_timestamp_memo_set);
+
+/*
+ * The bucket of a key is picked by the low bits of its hash code, so the
+ * partition is picked by the high ones.
+ */
+#define CT_MAP_PARTITION(hashcode) \
+    ((int) ((hashcode) >> (32 - CT_MAP_PARTITION_BITS)))
+
+#define CT_MAP_LOCK()   (&ct_shared->locks[0].lock)
+#define CT_PARTITION_LOCK(partition) \
+    (&ct_shared->locks[1 + (partition)].lock)
+
+void
+ct_map_init(void){
+    BackgroundWorker worker;
+
+    DefineCustomIntVariable("cascade_timestamp.shmem_entries",
+            "Number of keys kept in the shared-memory timestamp map.",
+            NULL,
+            &ct_map_entries,
+            65536, 1024, INT_MAX / 2,
+            PGC_POSTMASTER,
+            0,
+            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("cascade_timestamp.checkpoint_interval",
+            "Interval between writes of the shared-memory timestamp map to the destination tables.",
+            NULL,
+            &ct_map_interval,
+            1000, 10, INT_MAX,
+            PGC_SIGHUP,
+            GUC_UNIT_MS,
+            NULL, NULL, NULL);
+
+    DefineCustomStringVariable("cascade_timestamp.database",
+            "Database the shared-memory timestamp map is written back in.",
+            NULL,
+            &ct_map_database,
+            "postgres",
+            PGC_POSTMASTER,
+            0,
+            NULL, NULL, NULL);
+
+    if(!process_shared_preload_libraries_in_progress)
+        return;
+
+    MemSet(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+            BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = 10;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "cascade_timestamp");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN,
+            "cascade_timestamp_worker_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "cascade_timestamp checkpointer");
+    snprintf(worker.bgw_type, BGW_MAXLEN, "cascade_timestamp");
+    RegisterBackgroundWorker(&worker);
+}
+
+Size
+ct_map_shmem_size(void){
+    return add_size(MAXALIGN(sizeof(CtMapShared)),
+            mul_size(CT_MAP_PARTITIONS,
+                    hash_estimate_size(ct_map_partition_entries(),
+                            sizeof(CtMapEntry))));
+}
+
+void
+ct_map_shmem_request(void){
+    RequestAddinShmemSpace(ct_map_shmem_size());
+    RequestNamedLWLockTranche(CT_MAP_TRANCHE, CT_MAP_PARTITIONS + 1);
+}
+
+void
+ct_map_shmem_startup(void){
+    HASHCTL info;
+    char name[NAMEDATALEN];
+    bool found;
+    int i;
+
+    ct_shared = ShmemInitStruct("cascade_timestamp map",
+            sizeof(CtMapShared), &found);
+    if(!found){
+        ct_shared->locks = GetNamedLWLockTranche(CT_MAP_TRANCHE);
+        MemSet(ct_shared->generations, 0, sizeof(ct_shared->generations));
+        MemSet(ct_shared->horizons, 0, sizeof(ct_shared->horizons));
+        ct_shared->ndestinations = 0;
+    }
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(CtMapKey);
+    info.entrysize = sizeof(CtMapEntry);
+    for(i = 0; i < CT_MAP_PARTITIONS; i++){
+        snprintf(name, sizeof(name), "cascade_timestamp map entries %d", i);
+        ct_maps[i] = ShmemInitHash(name, ct_map_partition_entries(),
+                ct_map_partition_entries(), &info, HASH_ELEM | HASH_BLOBS);
+    }
+}
+
+bool
+ct_map_available(void){
+    return ct_maps[0] != NULL;
+}
+
+/*
+ * Remember how to write back entries for this destination. Returns false if
+ * there is no room for another destination.
+ */
+bool
+ct_map_register(Oid destination, Oid keytype, const char *tscolumn,
+        const char *keycolumn){
+    CtDestination *dest;
+    int i;
+
+    if(strlen(tscolumn) >= NAMEDATALEN || strlen(keycolumn) >= NAMEDATALEN)
+        return false;
+
+    LWLockAcquire(CT_MAP_LOCK(), LW_EXCLUSIVE);
+    for(i = 0; i < ct_shared->ndestinations; i++){
+        dest = &ct_shared->destinations[i];
+        if(dest->dboid == MyDatabaseId && dest->destination == destination)
+            break;
+    }
+
+    if(i == ct_shared->ndestinations){
+        if(i == CT_MAX_DESTINATIONS){
+            LWLockRelease(CT_MAP_LOCK());
+            return false;
+        }
+        ct_shared->ndestinations++;
+    }
+
+    dest = &ct_shared->destinations[i];
+    dest->dboid = MyDatabaseId;
+    dest->destination = destination;
+    dest->keytype = keytype;
+    strlcpy(dest->tscolumn, tscolumn, NAMEDATALEN);
+    strlcpy(dest->keycolumn, keycolumn, NAMEDATALEN);
+    LWLockRelease(CT_MAP_LOCK());
+    return true;
+}
+
+/*
+ * Store the timestamp for a key. Returns false if the key does not fit in
+ * the map, in which case the caller has to update the destination itself.
+ */
+bool
+ct_map_set(Oid destination, const char *key, TimestampTz ts){
+    CtMapKey mkey;
+    CtMapEntry *entry;
+    HTAB *map;
+    uint32 hashcode;
+    LWLock *lock;
+    int partition;
+    bool found;
+
+    if(!ct_map_key(&mkey, destination, key))
+        return false;
+
+    map = ct_map_partition(&mkey, &hashcode, &partition);
+    lock = CT_PARTITION_LOCK(partition);
+
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+    entry = ct_map_enter(map, &mkey, hashcode, &found);
+    if(entry != NULL && !found)
+        entry->invalidated = 0;
+    if(entry != NULL && (!found || entry->tombstone || entry->ts < ts)){
+        entry->ts = ts;
+        entry->dirty = true;
+        entry->tombstone = false;
+    }
+    LWLockRelease(lock);
+
+    return entry != NULL;
+}
+
+bool
+ct_map_get(Oid destination, const char *key, TimestampTz *ts){
+    CtMapKey mkey;
+    CtMapEntry *entry;
+    HTAB *map;
+    uint32 hashcode;
+    LWLock *lock;
+    int partition;
+
+    if(!ct_map_key(&mkey, destination, key))
+        return false;
+
+    map = ct_map_partition(&mkey, &hashcode, &partition);
+    lock = CT_PARTITION_LOCK(partition);
+
+    LWLockAcquire(lock, LW_SHARED);
+    entry = (CtMapEntry *)hash_search_with_hash_value(map, &mkey,
+            hashcode, HASH_FIND, NULL);
+    if(entry != NULL && entry->tombstone)
+        entry = NULL;
+    if(entry != NULL)
+        *ts = entry->ts;
+    LWLockRelease(lock);
+
+    return entry != NULL;
+}
+
+/*
+ * Forget the (memoized) timestamp of a key, leaving a tombstone with the new
+ * generation of its partition. If the partition is too full for one, its
+ * horizon is raised instead, which invalidates every key without an entry.
+ */
+void
+ct_map_invalidate(Oid destination, const char *key){
+    CtMapKey mkey;
+    CtMapEntry *entry;
+    HTAB *map;
+    uint32 hashcode;
+    LWLock *lock;
+    int partition;
+    bool found;
+
+    if(!ct_map_key(&mkey, destination, key))
+        return;
+
+    map = ct_map_partition(&mkey, &hashcode, &partition);
+    lock = CT_PARTITION_LOCK(partition);
+
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+    ct_shared->generations[partition]++;
+    entry = ct_map_enter(map, &mkey, hashcode, &found);
+    if(entry != NULL){
+        entry->dirty = false;
+        entry->tombstone = true;
+        entry->invalidated = ct_shared->generations[partition];
+    }else{
+        ct_shared->horizons[partition] = ct_shared->generations[partition];
+    }
+    LWLockRelease(lock);
+}
+
+/* Generation to pass to ct_map_memoize() for a value about to be computed */
+uint64
+ct_map_generation(Oid destination, const char *key){
+    CtMapKey mkey;
+    uint32 hashcode;
+    LWLock *lock;
+    int partition;
+    uint64 generation;
+
+    if(!ct_map_key(&mkey, destination, key))
+        return 0;
+
+    ct_map_partition(&mkey, &hashcode, &partition);
+    lock = CT_PARTITION_LOCK(partition);
+
+    LWLockAcquire(lock, LW_SHARED);
+    generation = ct_shared->generations[partition];
+    LWLockRelease(lock);
+
+    return generation;
+}
+
+/*
+ * Store a computed timestamp, unless the key was invalidated since
+ * `generation` was read. Memoized entries are never written back.
+ */
+bool
+ct_map_memoize(Oid destination, const char *key, TimestampTz ts,
+        uint64 generation){
+    CtMapKey mkey;
+    CtMapEntry *entry;
+    HTAB *map;
+    uint32 hashcode;
+    LWLock *lock;
+    int partition;
+    bool stored = false;
+    bool found;
+
+    if(!ct_map_key(&mkey, destination, key))
+        return false;
+
+    map = ct_map_partition(&mkey, &hashcode, &partition);
+    lock = CT_PARTITION_LOCK(partition);
+
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+    entry = (CtMapEntry *)hash_search_with_hash_value(map, &mkey,
+            hashcode, HASH_FIND, NULL);
+    if(entry != NULL ? entry->invalidated <= generation :
+            ct_shared->horizons[partition] <= generation){
+        if(entry == NULL){
+            entry = ct_map_enter(map, &mkey, hashcode, &found);
+            if(entry != NULL){
+                entry->dirty = false;
+                entry->tombstone = true;
+                entry->invalidated = 0;
+            }
+        }
+        if(entry != NULL && entry->tombstone){
+            entry->ts = ts;
+            entry->tombstone = false;
+        }
+        stored = (entry != NULL);
+    }
+    LWLockRelease(lock);
+
+    return stored;
+}
+
+static bool
+ct_map_key(CtMapKey *mkey, Oid destination, const char *key){
+    if(strlen(key) >= CT_MAX_KEY_LEN)
+        return false;
+
+    MemSet(mkey, 0, sizeof(CtMapKey));
+    mkey->dboid = MyDatabaseId;
+    mkey->destination = destination;
+    strlcpy(mkey->key, key, CT_MAX_KEY_LEN);
+    return true;
+}
+
+/*
+ * The partition of a key. Every partition hashes the same way, so the hash
+ * code can be computed with any of them.
+ */
+static HTAB *
+ct_map_partition(const CtMapKey *mkey, uint32 *hashcode, int *partition){
+    *hashcode = get_hash_value(ct_maps[0], mkey);
+    *partition = CT_MAP_PARTITION(*hashcode);
+    return ct_maps[*partition];
+}
+
+static long
+ct_map_partition_entries(void){
+    return ct_map_entries / CT_MAP_PARTITIONS;
+}
+
+/*
+ * The entry of a key, entered if the partition has room for it, or NULL. A
+ * shared hash table does not stop at the size it was created with, it goes
+ * on taking the spare shared memory the lock table and others rely on, so
+ * the size is enforced here like pg_stat_statements does.
+ */
+static CtMapEntry *
+ct_map_enter(HTAB *map, const CtMapKey *mkey, uint32 hashcode, bool *found){
+    CtMapEntry *entry;
+
+    entry = (CtMapEntry *)hash_search_with_hash_value(map, mkey, hashcode,
+            HASH_FIND, NULL);
+    *found = (entry != NULL);
+    if(entry == NULL && hash_get_num_entries(map) < ct_map_partition_entries()){
+        entry = (CtMapEntry *)hash_search_with_hash_value(map, mkey,
+                hashcode, HASH_ENTER_NULL, NULL);
+    }
+    return entry;
+}
+
+/*
+ * cascade_timestamp_shmem_get(destination regclass, key text)
+ *
+ * Returns the timestamp stored in the shared-memory map or NULL if the key
+ * is not in the map.
+ */
+Datum
+cascade_timestamp_shmem_get(PG_FUNCTION_ARGS){
+    Oid destination = PG_GETARG_OID(0);
+    char *key = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    TimestampTz ts;
+
+    if(!ct_map_available() || !ct_map_get(destination, key, &ts))
+        PG_RETURN_NULL();
+
+    PG_RETURN_TIMESTAMPTZ(ts);
+}
+
+/* cascade_timestamp_memo_generation(destination regclass, key text) */
+Datum
+cascade_timestamp_memo_generation(PG_FUNCTION_ARGS){
+    Oid destination = PG_GETARG_OID(0);
+    char *key = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    if(!ct_map_available())
+        PG_RETURN_NULL();
+
+    PG_RETURN_INT64((int64) ct_map_generation(destination, key));
+}
+
+/*
+ * cascade_timestamp_memo_set(destination regclass, key text, ts timestamptz,
+ *     generation bigint)
+ *
+ * Values computed under a transaction snapshot can be older than the last
+ * invalidation, so those are never memoized.
+ */
+Datum
+cascade_timestamp_memo_set(PG_FUNCTION_ARGS){
+    Oid destination = PG_GETARG_OID(0);
+    char *key = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    TimestampTz ts = PG_GETARG_TIMESTAMPTZ(2);
+    uint64 generation = (uint64) PG_GETARG_INT64(3);
+
+    if(!ct_map_available() || IsolationUsesXactSnapshot())
+        PG_RETURN_BOOL(false);
+
+    PG_RETURN_BOOL(ct_map_memoize(destination, key, ts, generation));
+}
+
+static void
+ct_worker_sighup(SIGNAL_ARGS){
+    int save_errno = errno;
+
+    got_sighup = true;
+    SetLatch(MyLatch);
+    errno = save_errno;
+}
+
+static void
+ct_worker_sigterm(SIGNAL_ARGS){
+    int save_errno = errno;
+
+    got_sigterm = true;
+    SetLatch(MyLatch);
+    errno = save_errno;
+}
+
+void
+cascade_timestamp_worker_main(Datum main_arg){
+    int rc;
+
+    pqsignal(SIGHUP, ct_worker_sighup);
+    pqsignal(SIGTERM, ct_worker_sigterm);
+    BackgroundWorkerUnblockSignals();
+
+    BackgroundWorkerInitializeConnection(ct_map_database, NULL, 0);
+
+    while(!got_sigterm){
+        rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                ct_map_interval, ct_activity_wait_event());
+        ResetLatch(MyLatch);
+
+        if(rc & WL_POSTMASTER_DEATH)
+            proc_exit(1);
+
+        CHECK_FOR_INTERRUPTS();
+
+        if(got_sighup){
+            got_sighup = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        while(ct_map_flush() && !got_sigterm)
+            ;
+    }
+
+    /* Write back whatever is left before shutting down */
+    while(ct_map_flush())
+        ;
+    proc_exit(0);
+}
+
+/*
+ * Write a batch of dirty entries for this database back to their
+ * destinations. Returns true if there are more dirty entries left.
+ */
+static bool
+ct_map_flush(void){
+    HASH_SEQ_STATUS status;
+    CtMapEntry *entry;
+    CtFlushItem *items;
+    bool *dropped;
+    CtDestination dest;
+    MemoryContext flushcontext, oldcontext;
+    HTAB *map;
+    uint32 hashcode;
+    LWLock *lock;
+    bool more = false;
+    int nitems = 0;
+    int partition;
+    int start, i;
+
+    flushcontext = AllocSetContextCreate(CurrentMemoryContext,
+            "cascade_timestamp flush", ALLOCSET_DEFAULT_SIZES);
+    oldcontext = MemoryContextSwitchTo(flushcontext);
+    items = (CtFlushItem *)palloc(CT_FLUSH_BATCH * sizeof(CtFlushItem));
+    dropped = (bool *)palloc0(CT_FLUSH_BATCH * sizeof(bool));
+
+    /* Copy out the dirty entries, holding one partition lock at a time */
+    for(partition = 0; partition < CT_MAP_PARTITIONS && !more; partition++){
+        lock = CT_PARTITION_LOCK(partition);
+        LWLockAcquire(lock, LW_SHARED);
+
+        hash_seq_init(&status, ct_maps[partition]);
+        while((entry = (CtMapEntry *)hash_seq_search(&status)) != NULL){
+            if(!entry->dirty || entry->key.dboid != MyDatabaseId)
+                continue;
+
+            if(nitems == CT_FLUSH_BATCH){
+                hash_seq_term(&status);
+                more = true;
+                break;
+            }
+
+            items[nitems].key = entry->key;
+            items[nitems].ts = entry->ts;
+            nitems++;
+        }
+
+        LWLockRelease(lock);
+    }
+
+    if(nitems > 0){
+        qsort(items, nitems, sizeof(CtFlushItem), ct_flush_item_cmp);
+
+        SetCurrentStatementStartTimestamp();
+        StartTransactionCommand();
+        SPI_connect();
+        PushActiveSnapshot(GetTransactionSnapshot());
+        pgstat_report_activity(STATE_RUNNING,
+                "cascade_timestamp: writing back shared-memory timestamps");
+        ct_activity_start(InvalidOid, InvalidOid, NULL);
+        ct_activity_progress(0, nitems);
+
+        for(start = 0; start < nitems; start = i){
+            for(i = start; i < nitems &&
+                    items[i].key.destination == items[start].key.destination;
+                    i++)
+                ;
+
+            /* Dropped destinations are simply forgotten */
+            if(ct_map_destination(items[start].key.destination, &dest) &&
+                    !ct_map_write_guarded(&dest, items + start, i - start)){
+                memset(dropped + start, true, (i - start) * sizeof(bool));
+            }
+            ct_activity_progress(i, nitems);
+        }
+
+        ct_activity_end();
+
+        SPI_finish();
+        PopActiveSnapshot();
+        CommitTransactionCommand();
+        pgstat_report_activity(STATE_IDLE, NULL);
+
+        /*
+         * Only now that the timestamps are committed the entries are clean,
+         * unless a newer timestamp was stored in the meantime. Those that
+         * could not be written are dropped rather than retried forever.
+         */
+        for(i = 0; i < nitems; i++){
+            map = ct_map_partition(&items[i].key, &hashcode, &partition);
+            lock = CT_PARTITION_LOCK(partition);
+
+            LWLockAcquire(lock, LW_EXCLUSIVE);
+            entry = (CtMapEntry *)hash_search_with_hash_value(map,
+                    &items[i].key, hashcode, HASH_FIND, NULL);
+            if(entry != NULL && entry->ts == items[i].ts && dropped[i]){
+                hash_search_with_hash_value(map, &items[i].key, hashcode,
+                        HASH_REMOVE, NULL);
+            }else if(entry != NULL && entry->ts == items[i].ts){
+                entry->dirty = false;
+            }
+            LWLockRelease(lock);
+        }
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextDelete(flushcontext);
+
+    ct_map_evict();
+    return more;
+}
+
+/*
+ * Drop the clean entries of every partition that is three quarters full so
+ * the triggers keep finding room. A later read of an evicted key falls back
+ * to the (already written back) destination table.
+ */
+static void
+ct_map_evict(void){
+    HASH_SEQ_STATUS status;
+    CtMapEntry *entry;
+    LWLock *lock;
+    int partition;
+
+    for(partition = 0; partition < CT_MAP_PARTITIONS; partition++){
+        if(hash_get_num_entries(ct_maps[partition]) <
+                ct_map_partition_entries() / 4 * 3)
+            continue;
+
+        lock = CT_PARTITION_LOCK(partition);
+        LWLockAcquire(lock, LW_EXCLUSIVE);
+
+        hash_seq_init(&status, ct_maps[partition]);
+        while((entry = (CtMapEntry *)hash_seq_search(&status)) != NULL){
+            if(entry->dirty)
+                continue;
+
+            if(entry->tombstone){
+                ct_shared->horizons[partition] = Max(
+                        ct_shared->horizons[partition], entry->invalidated);
+            }
+            hash_search(ct_maps[partition], &entry->key, HASH_REMOVE, NULL);
+        }
+
+        LWLockRelease(lock);
+    }
+}
+
+/*
+ * ct_map_write() in a subtransaction of its own, so that a destination that
+ * can no longer be written, for privileges or a constraint, does not take
+ * the worker and every other destination down with it. Returns false after
+ * logging the error.
+ */
+static bool
+ct_map_write_guarded(CtDestination *dest, CtFlushItem *items, int nitems){
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ResourceOwner oldowner = CurrentResourceOwner;
+    ErrorData *edata;
+    char *relname;
+
+    relname = get_rel_name(dest->destination);
+
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(oldcontext);
+    PG_TRY();
+    {
+        ct_map_write(dest, items, nitems);
+        ReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(oldcontext);
+        edata = CopyErrorData();
+        FlushErrorState();
+
+        RollbackAndReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
+
+        ereport(LOG,
+                (errmsg("cascade_timestamp: dropped %d timestamps of \"%s\" that could not be written back: %s",
+                        nitems, relname != NULL ? relname : "?",
+                        edata->message)));
+        FreeErrorData(edata);
+        return false;
+    }
+    PG_END_TRY();
+
+    return true;
+}
+
+/* Write the timestamps of one destination with a single UPDATE */
+static void
+ct_map_write(CtDestination *dest, CtFlushItem *items, int nitems){
+    Datum *keys = (Datum *)palloc(nitems * sizeof(Datum));
+    Datum *timestamps = (Datum *)palloc(nitems * sizeof(Datum));
+    Oid argtypes[2] = {TEXTARRAYOID, TIMESTAMPTZARRAYOID};
+    Datum values[2];
+    char *relname;
+    char sql[1024];
+    int ret;
+    int i;
+
+    relname = get_rel_name(dest->destination);
+    if(relname == NULL)
+        return;
+
+    for(i = 0; i < nitems; i++){
+        keys[i] = CStringGetTextDatum(items[i].key.key);
+        timestamps[i] = TimestampTzGetDatum(items[i].ts);
+    }
+
+    values[0] = PointerGetDatum(construct_array(keys, nitems, TEXTOID,
+            -1, false, 'i'));
+    values[1] = PointerGetDatum(construct_array(timestamps, nitems,
+            TIMESTAMPTZOID, sizeof(TimestampTz), FLOAT8PASSBYVAL, 'd'));
+
+    snprintf(
+            sql,
+            sizeof(sql),
+            "UPDATE %s AS d SET %s = v.ts "
+            "FROM unnest($1, $2) AS v(k, ts) "
+            "WHERE d.%s = v.k::%s AND (d.%s IS NULL OR d.%s < v.ts)",
+            quote_qualified_identifier(
+                    get_namespace_name(get_rel_namespace(dest->destination)),
+                    relname),
+            dest->tscolumn,
+            dest->keycolumn,
+            format_type_be(dest->keytype),
+            dest->tscolumn,
+            dest->tscolumn
+    );
+
+    ret = SPI_execute_with_args(sql, 2, argtypes, values, NULL, false, 0);
+    if(ret < 0){
+        elog(ERROR, "cascade_timestamp: SPI_execute_with_args returned %d",
+                ret);
+    }
+}
+
+static bool
+ct_map_destination(Oid destination, CtDestination *dest){
+    bool found = false;
+    int i;
+
+    LWLockAcquire(CT_MAP_LOCK(), LW_SHARED);
+    for(i = 0; i < ct_shared->ndestinations; i++){
+        if(ct_shared->destinations[i].dboid == MyDatabaseId &&
+                ct_shared->destinations[i].destination == destination){
+            *dest = ct_shared->destinations[i];
+            found = true;
+            break;
+        }
+    }
+    LWLockRelease(CT_MAP_LOCK());
+
+    return found;
+}
+
+static int
+ct_flush_item_cmp(const void *a, const void *b){
+    Oid da = ((const CtFlushItem *)a)->key.destination;
+    Oid db = ((const CtFlushItem *)b)->key.destination;
+
+    return (da > db) - (da < db);
+}
@@ -0,0 +1,506 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Per-trigger runtime statistics, exposed through the cascade_timestamp_stats
+view.
+
+Every trigger gets a fixed entry of atomic counters in shared memory, keyed
+by database and trigger OID. The lock is only taken to find or create the
+entry; backends cache the pointer in their plan, so counting is a single
+atomic add. Resetting only zeroes the counters, so cached pointers stay
+valid. Once the table is full, the entries of triggers and databases that
+were dropped are removed to make room: a dropped trigger cannot fire again,
+so nobody uses a pointer to its entry anymore.
+
+With `cascade_timestamp.track_timing` the entry also holds log-bucketed
+latency histograms of whole invocations and of the destination statements
+(which is where waits for the destination row lock end up). Bucket 0 counts
+durations under 1us, bucket b durations in [2^(b-1), 2^b) us.
+
+Requires `shared_preload_libraries = 'cascade_timestamp'`, otherwise nothing
+is counted.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/genam.h"
+#include "access/table.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_trigger.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
+
+#define CT_STATS_TRANCHE    "cascade_timestamp_stats"
+
+typedef struct {
+    Oid dboid;
+    Oid trigger;
+} CtStatsKey;
+
+struct CtStats {
+    CtStatsKey key;
+    pg_atomic_uint64 counters[CT_STAT_COUNT];
+    pg_atomic_uint64 histograms[CT_TIME_COUNT][CT_HIST_BUCKETS];
+};
+
+static const char *const ct_time_names[CT_TIME_COUNT] = {"total", "statement"};
+
+typedef struct {
+    LWLock *lock;
+} CtStatsShared;
+
+extern Datum cascade_timestamp_stats(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_stats_reset(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_histogram(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_latency(PG_FUNCTION_ARGS);
+
+static CtStatsShared *ct_stats_shared = NULL;
+static HTAB *ct_stats = NULL;
+
+static int ct_stats_max = 1000;
+bool ct_track_timing = true;
+
+static void ct_stats_zero(CtStats *entry);
+static int ct_stats_recycle(void);
+static bool ct_stats_dropped(const CtStatsKey *key);
+static double ct_percentile(uint64 *buckets, uint64 count, double fraction);
+
+PG_FUNCTION_INFO_V1(cascade_timestamp_stats);
+PG_FUNCTION_INFO_V1(cascade_timestamp_stats_reset);
+PG_FUNCTION_INFO_V1(cascade_timestamp_histogram);
+PG_FUNCTION_INFO_V1(cascade_timestamp_latency);
+
+void
+ct_stats_init(void){
+    DefineCustomIntVariable("cascade_timestamp.max_triggers",
+            "Number of triggers statistics are kept for.",
+            NULL,
+            &ct_stats_max,
+            1000, 16, INT_MAX / 2,
+            PGC_POSTMASTER,
+            0,
+            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("cascade_timestamp.track_timing",
+            "Collects latency histograms of the cascades.",
+            NULL,
+            &ct_track_timing,
+            true,
+            PGC_SUSET,
+            0,
+            NULL, NULL, NULL);
+}
+
+Size
+ct_stats_shmem_size(void){
+    return add_size(MAXALIGN(sizeof(CtStatsShared)),
+            hash_estimate_size(ct_stats_max, sizeof(CtStats)));
+}
+
+void
+ct_stats_shmem_request(void){
+    RequestAddinShmemSpace(ct_stats_shmem_size());
+    RequestNamedLWLockTranche(CT_STATS_TRANCHE, 1);
+}
+
+void
+ct_stats_shmem_startup(void){
+    HASHCTL info;
+    bool found;
+
+    ct_stats_shared = ShmemInitStruct("cascade_timestamp stats",
+            sizeof(CtStatsShared), &found);
+    if(!found)
+        ct_stats_shared->lock = &(GetNamedLWLockTranche(CT_STATS_TRANCHE))->lock;
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(CtStatsKey);
+    info.entrysize = sizeof(CtStats);
+    ct_stats = ShmemInitHash("cascade_timestamp stats entries",
+            ct_stats_max, ct_stats_max, &info, HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * The statistics entry of a trigger, created if needed. NULL if statistics
+ * are not available or there is no room for another trigger, even after
+ * recycling the entries of dropped ones.
+ */
+CtStats *
+ct_stats_entry(Oid trigger){
+    CtStatsKey key;
+    CtStats *entry;
+    bool found;
+    int i;
+
+    if(ct_stats == NULL)
+        return NULL;
+
+    MemSet(&key, 0, sizeof(key));
+    key.dboid = MyDatabaseId;
+    key.trigger = trigger;
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    entry = (CtStats *)hash_search(ct_stats, &key, HASH_FIND, NULL);
+    LWLockRelease(ct_stats_shared->lock);
+    if(entry != NULL)
+        return entry;
+
+    LWLockAcquire(ct_stats_shared->lock, LW_EXCLUSIVE);
+    entry = (CtStats *)hash_search(ct_stats, &key, HASH_ENTER_NULL, &found);
+    if(entry == NULL){
+        LWLockRelease(ct_stats_shared->lock);
+        if(ct_stats_recycle() == 0)
+            return NULL;
+
+        LWLockAcquire(ct_stats_shared->lock, LW_EXCLUSIVE);
+        entry = (CtStats *)hash_search(ct_stats, &key, HASH_ENTER_NULL,
+                &found);
+    }
+    if(entry != NULL && !found){
+        for(i = 0; i < CT_STAT_COUNT; i++)
+            pg_atomic_init_u64(&entry->counters[i], 0);
+        for(i = 0; i < CT_TIME_COUNT * CT_HIST_BUCKETS; i++)
+            pg_atomic_init_u64(&entry->histograms[0][i], 0);
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    return entry;
+}
+
+void
+ct_stats_add(CtStats *stats, CtStatCounter counter, uint64 value){
+    if(stats != NULL)
+        pg_atomic_fetch_add_u64(&stats->counters[counter], value);
+    ct_statement_counters[counter] += value;
+}
+
+/*
+ * Set up a set-returning function to return its rows through a tuplestore.
+ * Returns the tuplestore, the tuple descriptor is stored in `tupdesc`.
+ */
+Tuplestorestate *
+ct_materialize(FunctionCallInfo fcinfo, TupleDesc *tupdesc){
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+
+    if(rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+            !(rsinfo->allowedModes & SFRM_Materialize)){
+        elog(ERROR, "cascade_timestamp: set-valued function called in context that cannot accept a set");
+    }
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    if(get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "cascade_timestamp: return type must be a row type");
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = *tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+    return tupstore;
+}
+
+/*
+ * cascade_timestamp_stats() returns (trigger oid, invocations, ...)
+ *
+ * The counters of all triggers in the current database, in the order of
+ * CtStatCounter.
+ */
+Datum
+cascade_timestamp_stats(PG_FUNCTION_ARGS){
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    HASH_SEQ_STATUS status;
+    CtStats *entry;
+    Datum values[CT_STAT_COUNT + 1];
+    bool nulls[CT_STAT_COUNT + 1];
+    int i;
+
+    tupstore = ct_materialize(fcinfo, &tupdesc);
+    if(ct_stats == NULL)
+        return (Datum) 0;
+
+    MemSet(nulls, 0, sizeof(nulls));
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    hash_seq_init(&status, ct_stats);
+    while((entry = (CtStats *)hash_seq_search(&status)) != NULL){
+        if(entry->key.dboid != MyDatabaseId)
+            continue;
+
+        values[0] = ObjectIdGetDatum(entry->key.trigger);
+        for(i = 0; i < CT_STAT_COUNT; i++){
+            values[i + 1] = Int64GetDatum(
+                    (int64) pg_atomic_read_u64(&entry->counters[i]));
+        }
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * cascade_timestamp_stats_reset(trigger oid DEFAULT NULL)
+ *
+ * Zeroes the counters of one trigger, or of all triggers in the current
+ * database.
+ */
+Datum
+cascade_timestamp_stats_reset(PG_FUNCTION_ARGS){
+    HASH_SEQ_STATUS status;
+    CtStats *entry;
+
+    if(ct_stats == NULL)
+        PG_RETURN_VOID();
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    hash_seq_init(&status, ct_stats);
+    while((entry = (CtStats *)hash_seq_search(&status)) != NULL){
+        if(entry->key.dboid != MyDatabaseId ||
+                (!PG_ARGISNULL(0) && entry->key.trigger != PG_GETARG_OID(0)))
+            continue;
+
+        ct_stats_zero(entry);
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    PG_RETURN_VOID();
+}
+
+/*
+ * cascade_timestamp_histogram() returns (trigger oid, kind text,
+ *     lower_us bigint, upper_us bigint, count bigint)
+ *
+ * The non-empty histogram buckets of all triggers in the current database.
+ * The upper bound of the last bucket is NULL.
+ */
+Datum
+cascade_timestamp_histogram(PG_FUNCTION_ARGS){
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    HASH_SEQ_STATUS status;
+    CtStats *entry;
+    Datum values[5];
+    bool nulls[5];
+    uint64 count;
+    int kind, bucket;
+
+    tupstore = ct_materialize(fcinfo, &tupdesc);
+    if(ct_stats == NULL)
+        return (Datum) 0;
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    hash_seq_init(&status, ct_stats);
+    while((entry = (CtStats *)hash_seq_search(&status)) != NULL){
+        if(entry->key.dboid != MyDatabaseId)
+            continue;
+
+        for(kind = 0; kind < CT_TIME_COUNT; kind++){
+            for(bucket = 0; bucket < CT_HIST_BUCKETS; bucket++){
+                count = pg_atomic_read_u64(&entry->histograms[kind][bucket]);
+                if(count == 0)
+                    continue;
+
+                MemSet(nulls, 0, sizeof(nulls));
+                values[0] = ObjectIdGetDatum(entry->key.trigger);
+                values[1] = CStringGetTextDatum(ct_time_names[kind]);
+                values[2] = Int64GetDatum(bucket == 0 ? 0 :
+                        (int64) 1 << (bucket - 1));
+                values[3] = Int64GetDatum((int64) 1 << bucket);
+                nulls[3] = (bucket == CT_HIST_BUCKETS - 1);
+                values[4] = Int64GetDatum((int64) count);
+                tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+            }
+        }
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * cascade_timestamp_latency() returns (trigger oid, kind text, count bigint,
+ *     p50_us float8, p90_us float8, p99_us float8, p999_us float8)
+ *
+ * Percentiles estimated from the histograms by interpolating within the
+ * bucket they fall in.
+ */
+Datum
+cascade_timestamp_latency(PG_FUNCTION_ARGS){
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    HASH_SEQ_STATUS status;
+    CtStats *entry;
+    Datum values[7];
+    bool nulls[7];
+    uint64 buckets[CT_HIST_BUCKETS];
+    uint64 count;
+    int kind, bucket;
+
+    tupstore = ct_materialize(fcinfo, &tupdesc);
+    if(ct_stats == NULL)
+        return (Datum) 0;
+
+    MemSet(nulls, 0, sizeof(nulls));
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    hash_seq_init(&status, ct_stats);
+    while((entry = (CtStats *)hash_seq_search(&status)) != NULL){
+        if(entry->key.dboid != MyDatabaseId)
+            continue;
+
+        for(kind = 0; kind < CT_TIME_COUNT; kind++){
+            count = 0;
+            for(bucket = 0; bucket < CT_HIST_BUCKETS; bucket++){
+                buckets[bucket] = pg_atomic_read_u64(
+                        &entry->histograms[kind][bucket]);
+                count += buckets[bucket];
+            }
+            if(count == 0)
+                continue;
+
+            values[0] = ObjectIdGetDatum(entry->key.trigger);
+            values[1] = CStringGetTextDatum(ct_time_names[kind]);
+            values[2] = Int64GetDatum((int64) count);
+            values[3] = Float8GetDatum(ct_percentile(buckets, count, 0.5));
+            values[4] = Float8GetDatum(ct_percentile(buckets, count, 0.9));
+            values[5] = Float8GetDatum(ct_percentile(buckets, count, 0.99));
+            values[6] = Float8GetDatum(ct_percentile(buckets, count, 0.999));
+            tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        }
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    return (Datum) 0;
+}
+
+void
+ct_stats_time(CtStats *stats, CtTiming kind, instr_time duration){
+    uint64 us;
+    int bucket = 0;
+
+    if(stats == NULL)
+        return;
+
+    us = INSTR_TIME_GET_MICROSEC(duration);
+    while(us > 0 && bucket < CT_HIST_BUCKETS - 1){
+        us >>= 1;
+        bucket++;
+    }
+
+    pg_atomic_fetch_add_u64(&stats->histograms[kind][bucket], 1);
+}
+
+static void
+ct_stats_zero(CtStats *entry){
+    int i;
+
+    for(i = 0; i < CT_STAT_COUNT; i++)
+        pg_atomic_write_u64(&entry->counters[i], 0);
+    for(i = 0; i < CT_TIME_COUNT * CT_HIST_BUCKETS; i++)
+        pg_atomic_write_u64(&entry->histograms[0][i], 0);
+}
+
+/*
+ * Remove the entries of dropped triggers and databases, returns how many.
+ * The catalogs are looked up without holding the lock.
+ */
+static int
+ct_stats_recycle(void){
+    HASH_SEQ_STATUS status;
+    CtStats *entry;
+    CtStatsKey *keys;
+    int nkeys = 0;
+    int ndropped = 0;
+    int i;
+
+    keys = (CtStatsKey *)palloc(ct_stats_max * sizeof(CtStatsKey));
+
+    LWLockAcquire(ct_stats_shared->lock, LW_SHARED);
+    hash_seq_init(&status, ct_stats);
+    while((entry = (CtStats *)hash_seq_search(&status)) != NULL){
+        if(nkeys == ct_stats_max){
+            hash_seq_term(&status);
+            break;
+        }
+        keys[nkeys++] = entry->key;
+    }
+    LWLockRelease(ct_stats_shared->lock);
+
+    for(i = 0; i < nkeys; i++){
+        if(ct_stats_dropped(&keys[i]))
+            keys[ndropped++] = keys[i];
+    }
+
+    if(ndropped > 0){
+        LWLockAcquire(ct_stats_shared->lock, LW_EXCLUSIVE);
+        for(i = 0; i < ndropped; i++)
+            hash_search(ct_stats, &keys[i], HASH_REMOVE, NULL);
+        LWLockRelease(ct_stats_shared->lock);
+    }
+
+    pfree(keys);
+    return ndropped;
+}
+
+/*
+ * Triggers can only be looked up in the current database, the entries of
+ * other databases are only recycled once the database is dropped.
+ */
+static bool
+ct_stats_dropped(const CtStatsKey *key){
+    Relation rel;
+    SysScanDesc scan;
+    ScanKeyData skey;
+    bool dropped;
+
+    if(key->dboid != MyDatabaseId){
+        return !SearchSysCacheExists1(DATABASEOID,
+                ObjectIdGetDatum(key->dboid));
+    }
+
+    rel = table_open(TriggerRelationId, AccessShareLock);
+    ScanKeyInit(&skey, Anum_pg_trigger_oid, BTEqualStrategyNumber, F_OIDEQ,
+            ObjectIdGetDatum(key->trigger));
+    scan = systable_beginscan(rel, TriggerOidIndexId, true, NULL, 1, &skey);
+    dropped = !HeapTupleIsValid(systable_getnext(scan));
+    systable_endscan(scan);
+    table_close(rel, AccessShareLock);
+
+    return dropped;
+}
+
+static double
+ct_percentile(uint64 *buckets, uint64 count, double fraction){
+    double rank = fraction * count;
+    double seen = 0;
+    double lower, upper;
+    int bucket;
+
+    for(bucket = 0; bucket < CT_HIST_BUCKETS; bucket++){
+        if(buckets[bucket] > 0 && seen + buckets[bucket] >= rank)
+            break;
+        seen += buckets[bucket];
+    }
+
+    /* The last bucket is open-ended, report its lower bound */
+    if(bucket >= CT_HIST_BUCKETS - 1)
+        return (double) ((uint64) 1 << (CT_HIST_BUCKETS - 2));
+
+    lower = bucket == 0 ? 0 : (double) ((uint64) 1 << (bucket - 1));
+    upper = (double) ((uint64) 1 << bucket);
+    return lower + (upper - lower) * (rank - seen) / buckets[bucket];
+}
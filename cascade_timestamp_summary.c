@@ -0,0 +1,234 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Per-statement summary of the cascades, for sizing bulk operations:
+
+    SET cascade_timestamp.statement_summary = notice;
+    UPDATE post SET ...;
+    NOTICE:  cascade_timestamp: statement summary: 10000 rows, ...
+
+Besides the shared statistics every counter is also added to a
+backend-local copy, which is reported and cleared when a top-level
+statement finishes. The row triggers of a statement fire in its
+ExecutorFinish, so that is where the summary is emitted, once the nesting
+level tracked by the ExecutorRun and ExecutorFinish hooks is back at zero.
+Statements run by the trigger itself are recognised by the trigger depth
+and never report, their cascades count towards the outer statement.
+Deferred triggers fired at commit, outside of any statement, are reported
+right before commit. So are the cascades of statements that do not go
+through the executor, such as COPY, unless another statement of the
+transaction finishes first and reports them along with its own.
+
+Destination keys are counted once per statement in a backend-local hash
+table, which is only filled while the summary is enabled.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/xact.h"
+#include "executor/executor.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#if PG_VERSION_NUM >= 180000
+#define CT_EXECUTOR_RUN_ARGS \
+    QueryDesc *queryDesc, ScanDirection direction, uint64 count
+#define CT_EXECUTOR_RUN_CALL queryDesc, direction, count
+#else
+#define CT_EXECUTOR_RUN_ARGS \
+    QueryDesc *queryDesc, ScanDirection direction, uint64 count, \
+    bool execute_once
+#define CT_EXECUTOR_RUN_CALL queryDesc, direction, count, execute_once
+#endif
+
+typedef struct {
+    Oid destination;
+    char key[CT_MAX_KEY_LEN];
+} CtSummaryKey;
+
+static const struct config_enum_entry ct_summary_options[] = {
+    {"off", 0, false},
+    {"notice", NOTICE, false},
+    {"log", LOG, false},
+    {NULL, 0, false}
+};
+
+int ct_statement_summary = 0;
+uint64 ct_statement_counters[CT_STAT_COUNT];
+
+static instr_time ct_statement_time;
+static MemoryContext ct_summary_context = NULL;
+static HTAB *ct_summary_keys = NULL;
+static long ct_summary_nkeys = 0;
+static int ct_nesting = 0;
+static int ct_trigger_depth = 0;
+
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+
+static void ct_ExecutorRun(CT_EXECUTOR_RUN_ARGS);
+static void ct_ExecutorFinish(QueryDesc *queryDesc);
+static void ct_summary_emit(const char *what);
+static void ct_summary_reset(void);
+static void ct_summary_xact_callback(XactEvent event, void *arg);
+
+void
+ct_summary_init(void){
+    DefineCustomEnumVariable("cascade_timestamp.statement_summary",
+            "Reports what the cascades of every statement did.",
+            NULL,
+            &ct_statement_summary,
+            0,
+            ct_summary_options,
+            PGC_USERSET,
+            0,
+            NULL, NULL, NULL);
+
+    ct_summary_reset();
+
+    prev_ExecutorRun = ExecutorRun_hook;
+    ExecutorRun_hook = ct_ExecutorRun;
+    prev_ExecutorFinish = ExecutorFinish_hook;
+    ExecutorFinish_hook = ct_ExecutorFinish;
+    RegisterXactCallback(ct_summary_xact_callback, NULL);
+}
+
+/* Brackets every trigger invocation while the summary is enabled */
+void
+ct_summary_enter(void){
+    ct_trigger_depth++;
+}
+
+void
+ct_summary_leave(void){
+    ct_trigger_depth--;
+}
+
+void
+ct_summary_time(instr_time duration){
+    INSTR_TIME_ADD(ct_statement_time, duration);
+}
+
+/* Count a destination key, once per statement */
+void
+ct_summary_key(Oid destination, const char *key){
+    CtSummaryKey skey;
+    HASHCTL info;
+    bool found;
+
+    if(ct_summary_keys == NULL){
+        if(ct_summary_context == NULL){
+            ct_summary_context = AllocSetContextCreate(TopMemoryContext,
+                    "cascade_timestamp summary keys", ALLOCSET_DEFAULT_SIZES);
+        }
+
+        MemSet(&info, 0, sizeof(info));
+        info.keysize = sizeof(CtSummaryKey);
+        info.entrysize = sizeof(CtSummaryKey);
+        info.hcxt = ct_summary_context;
+        ct_summary_keys = hash_create("cascade_timestamp summary keys", 256,
+                &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+
+    MemSet(&skey, 0, sizeof(skey));
+    skey.destination = destination;
+    strlcpy(skey.key, key, CT_MAX_KEY_LEN);
+    hash_search(ct_summary_keys, &skey, HASH_ENTER, &found);
+    if(!found)
+        ct_summary_nkeys++;
+}
+
+static void
+ct_ExecutorRun(CT_EXECUTOR_RUN_ARGS){
+    ct_nesting++;
+    PG_TRY();
+    {
+        if(prev_ExecutorRun)
+            prev_ExecutorRun(CT_EXECUTOR_RUN_CALL);
+        else
+            standard_ExecutorRun(CT_EXECUTOR_RUN_CALL);
+    }
+    PG_CATCH();
+    {
+        ct_nesting--;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    ct_nesting--;
+}
+
+static void
+ct_ExecutorFinish(QueryDesc *queryDesc){
+    ct_nesting++;
+    PG_TRY();
+    {
+        if(prev_ExecutorFinish)
+            prev_ExecutorFinish(queryDesc);
+        else
+            standard_ExecutorFinish(queryDesc);
+    }
+    PG_CATCH();
+    {
+        ct_nesting--;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    ct_nesting--;
+
+    if(ct_nesting == 0 && ct_trigger_depth == 0)
+        ct_summary_emit("statement summary");
+}
+
+static void
+ct_summary_emit(const char *what){
+    if(ct_statement_summary != 0 &&
+            ct_statement_counters[CT_STAT_INVOCATIONS] > 0){
+        elog(ct_statement_summary, "cascade_timestamp: %s: " UINT64_FORMAT " rows, " UINT64_FORMAT " unchanged, " UINT64_FORMAT " filtered, " UINT64_FORMAT " without key, %ld distinct keys, " UINT64_FORMAT " destination updates, %.3f ms",
+                what,
+                ct_statement_counters[CT_STAT_INVOCATIONS],
+                ct_statement_counters[CT_STAT_NOOP],
+                ct_statement_counters[CT_STAT_FILTERED],
+                ct_statement_counters[CT_STAT_NULL_KEYS],
+                ct_summary_nkeys,
+                ct_statement_counters[CT_STAT_UPDATES],
+                INSTR_TIME_GET_MILLISEC(ct_statement_time));
+    }
+
+    ct_summary_reset();
+}
+
+static void
+ct_summary_reset(void){
+    MemSet(ct_statement_counters, 0, sizeof(ct_statement_counters));
+    INSTR_TIME_SET_ZERO(ct_statement_time);
+
+    if(ct_summary_keys != NULL){
+        ct_summary_keys = NULL;
+        MemoryContextReset(ct_summary_context);
+    }
+    ct_summary_nkeys = 0;
+}
+
+/*
+ * Deferred triggers have fired by the time of PRE_COMMIT. The counts of an
+ * aborted transaction are dropped, they were not reported by the failed
+ * statement either.
+ */
+static void
+ct_summary_xact_callback(XactEvent event, void *arg){
+    switch(event){
+        case XACT_EVENT_PRE_COMMIT:
+        case XACT_EVENT_PRE_PREPARE:
+            ct_summary_emit("commit summary");
+            break;
+        case XACT_EVENT_ABORT:
+            ct_nesting = 0;
+            ct_trigger_depth = 0;
+            ct_summary_reset();
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,391 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Approximate top-K of the hottest destination keys.
+
+Cascades are counted per `(database, destination, key)` with the
+space-saving algorithm: `cascade_timestamp.top_keys` counters are kept in a
+min-heap, a key that is not tracked yet takes over the counter with the
+lowest count and inherits that count as its error. Any key with more than
+N / top_keys of the N counted cascades is guaranteed to be tracked, and its
+count overestimates the real one by at most its error.
+
+With `cascade_timestamp.top_keys_decay` all counts are halved every so many
+seconds so the sketch follows the current hot keys instead of the all-time
+ones.
+
+The sketch sits behind a single lock. A cascade that finds it busy is not
+counted rather than waiting for it, so the guarantee only holds for the
+cascades that were counted. Those that were not are added up in `skipped`,
+see cascade_timestamp_top_keys_skipped(); when it is a noticeable share of
+the cascades the hot keys may be missing from the list.
+
+Requires `shared_preload_libraries = 'cascade_timestamp'` and a non-zero
+`cascade_timestamp.top_keys`.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+
+#define CT_TOP_TRANCHE  "cascade_timestamp_top"
+
+typedef struct {
+    Oid dboid;
+    Oid destination;
+    char key[CT_MAX_KEY_LEN];
+} CtTopKey;
+
+/* Hash entry, points at the counter of the key */
+typedef struct {
+    CtTopKey key;
+    int slot;
+} CtTopEntry;
+
+typedef struct {
+    CtTopEntry *entry;
+    uint64 count;
+    uint64 error;   /* count the key inherited when it took the counter */
+} CtTopSlot;
+
+typedef struct {
+    LWLock *lock;
+    TimestampTz decayed;
+    pg_atomic_uint64 skipped;   /* cascades not counted, the lock was busy */
+    int nused;
+    CtTopSlot slots[FLEXIBLE_ARRAY_MEMBER];    /* min-heap on count */
+} CtTopShared;
+
+typedef struct {
+    Oid dboid;
+    Oid destination;
+    char key[CT_MAX_KEY_LEN];
+    uint64 count;
+    uint64 error;
+} CtTopItem;
+
+extern Datum cascade_timestamp_top_keys(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_top_keys_reset(PG_FUNCTION_ARGS);
+extern Datum cascade_timestamp_top_keys_skipped(PG_FUNCTION_ARGS);
+
+static CtTopShared *ct_top_shared = NULL;
+static HTAB *ct_top = NULL;
+
+static int ct_top_max = 0;
+static int ct_top_decay = 0;
+
+static void ct_top_decay_counts(void);
+static void ct_top_sift_down(int slot);
+static void ct_top_sift_up(int slot);
+static void ct_top_swap(int a, int b);
+static int ct_top_item_cmp(const void *a, const void *b);
+
+PG_FUNCTION_INFO_V1(cascade_timestamp_top_keys);
+PG_FUNCTION_INFO_V1(cascade_timestamp_top_keys_reset);
+PG_FUNCTION_INFO_V1(cascade_timestamp_top_keys_skipped);
+
+void
+ct_top_init(void){
+    DefineCustomIntVariable("cascade_timestamp.top_keys",
+            "Number of counters of the hot destination key sketch, 0 disables it.",
+            NULL,
+            &ct_top_max,
+            0, 0, 1000000,
+            PGC_POSTMASTER,
+            0,
+            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("cascade_timestamp.top_keys_decay",
+            "Interval after which the hot destination key counts are halved, 0 disables decay.",
+            NULL,
+            &ct_top_decay,
+            0, 0, INT_MAX,
+            PGC_SIGHUP,
+            GUC_UNIT_S,
+            NULL, NULL, NULL);
+}
+
+Size
+ct_top_shmem_size(void){
+    if(ct_top_max == 0)
+        return 0;
+
+    return add_size(MAXALIGN(add_size(offsetof(CtTopShared, slots),
+                    mul_size(ct_top_max, sizeof(CtTopSlot)))),
+            hash_estimate_size(ct_top_max, sizeof(CtTopEntry)));
+}
+
+void
+ct_top_shmem_request(void){
+    if(ct_top_max == 0)
+        return;
+
+    RequestAddinShmemSpace(ct_top_shmem_size());
+    RequestNamedLWLockTranche(CT_TOP_TRANCHE, 1);
+}
+
+void
+ct_top_shmem_startup(void){
+    HASHCTL info;
+    bool found;
+
+    if(ct_top_max == 0)
+        return;
+
+    ct_top_shared = ShmemInitStruct("cascade_timestamp top keys",
+            offsetof(CtTopShared, slots) + ct_top_max * sizeof(CtTopSlot),
+            &found);
+    if(!found){
+        ct_top_shared->lock = &(GetNamedLWLockTranche(CT_TOP_TRANCHE))->lock;
+        ct_top_shared->decayed = 0;
+        pg_atomic_init_u64(&ct_top_shared->skipped, 0);
+        ct_top_shared->nused = 0;
+    }
+
+    MemSet(&info, 0, sizeof(info));
+    info.keysize = sizeof(CtTopKey);
+    info.entrysize = sizeof(CtTopEntry);
+    ct_top = ShmemInitHash("cascade_timestamp top key entries",
+            ct_top_max, ct_top_max, &info, HASH_ELEM | HASH_BLOBS);
+}
+
+bool
+ct_top_available(void){
+    return ct_top != NULL;
+}
+
+/*
+ * Count a cascade to `key` of `destination`. Keys longer than the sketch
+ * can hold are counted under their truncated text.
+ */
+void
+ct_top_count(Oid destination, const char *key){
+    CtTopKey tkey;
+    CtTopEntry *entry;
+    CtTopSlot *slot;
+    uint64 count;
+    bool found;
+
+    if(ct_top == NULL)
+        return;
+
+    MemSet(&tkey, 0, sizeof(tkey));
+    tkey.dboid = MyDatabaseId;
+    tkey.destination = destination;
+    strlcpy(tkey.key, key, CT_MAX_KEY_LEN);
+
+    if(!LWLockConditionalAcquire(ct_top_shared->lock, LW_EXCLUSIVE)){
+        pg_atomic_fetch_add_u64(&ct_top_shared->skipped, 1);
+        return;
+    }
+
+    if(ct_top_decay > 0)
+        ct_top_decay_counts();
+
+    entry = (CtTopEntry *)hash_search(ct_top, &tkey, HASH_FIND, NULL);
+    if(entry != NULL){
+        ct_top_shared->slots[entry->slot].count++;
+        ct_top_sift_down(entry->slot);
+    }else if(ct_top_shared->nused < ct_top_max){
+        entry = (CtTopEntry *)hash_search(ct_top, &tkey, HASH_ENTER, &found);
+        entry->slot = ct_top_shared->nused++;
+        slot = &ct_top_shared->slots[entry->slot];
+        slot->entry = entry;
+        slot->count = 1;
+        slot->error = 0;
+        ct_top_sift_up(entry->slot);
+    }else{
+        /* Take over the counter of the least counted key */
+        slot = &ct_top_shared->slots[0];
+        count = slot->count;
+        hash_search(ct_top, &slot->entry->key, HASH_REMOVE, NULL);
+
+        entry = (CtTopEntry *)hash_search(ct_top, &tkey, HASH_ENTER, &found);
+        entry->slot = 0;
+        slot->entry = entry;
+        slot->count = count + 1;
+        slot->error = count;
+        ct_top_sift_down(0);
+    }
+
+    LWLockRelease(ct_top_shared->lock);
+}
+
+/*
+ * cascade_timestamp_top_keys() returns (destination regclass, key text,
+ *     count bigint, error bigint)
+ *
+ * The tracked keys of the current database, hottest first. `count - error`
+ * is a lower bound of the number of cascades to the key.
+ */
+Datum
+cascade_timestamp_top_keys(PG_FUNCTION_ARGS){
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    CtTopItem *items;
+    CtTopSlot *slot;
+    Datum values[4];
+    bool nulls[4];
+    int nitems = 0;
+    int i;
+
+    tupstore = ct_materialize(fcinfo, &tupdesc);
+    if(ct_top == NULL)
+        return (Datum) 0;
+
+    /* Copy the counters out so the sketch is not locked while sorting */
+    items = (CtTopItem *)palloc(ct_top_max * sizeof(CtTopItem));
+    LWLockAcquire(ct_top_shared->lock, LW_SHARED);
+    for(i = 0; i < ct_top_shared->nused; i++){
+        slot = &ct_top_shared->slots[i];
+        if(slot->entry->key.dboid != MyDatabaseId)
+            continue;
+
+        items[nitems].dboid = slot->entry->key.dboid;
+        items[nitems].destination = slot->entry->key.destination;
+        memcpy(items[nitems].key, slot->entry->key.key, CT_MAX_KEY_LEN);
+        items[nitems].count = slot->count;
+        items[nitems].error = slot->error;
+        nitems++;
+    }
+    LWLockRelease(ct_top_shared->lock);
+
+    qsort(items, nitems, sizeof(CtTopItem), ct_top_item_cmp);
+
+    MemSet(nulls, 0, sizeof(nulls));
+    for(i = 0; i < nitems; i++){
+        values[0] = ObjectIdGetDatum(items[i].destination);
+        values[1] = CStringGetTextDatum(items[i].key);
+        values[2] = Int64GetDatum((int64) items[i].count);
+        values[3] = Int64GetDatum((int64) items[i].error);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    pfree(items);
+    return (Datum) 0;
+}
+
+/*
+ * cascade_timestamp_top_keys_reset()
+ *
+ * Forgets all tracked keys, of every database, and the skipped count.
+ */
+Datum
+cascade_timestamp_top_keys_reset(PG_FUNCTION_ARGS){
+    int i;
+
+    if(ct_top == NULL)
+        PG_RETURN_VOID();
+
+    LWLockAcquire(ct_top_shared->lock, LW_EXCLUSIVE);
+    for(i = 0; i < ct_top_shared->nused; i++){
+        hash_search(ct_top, &ct_top_shared->slots[i].entry->key,
+                HASH_REMOVE, NULL);
+    }
+    ct_top_shared->nused = 0;
+    pg_atomic_write_u64(&ct_top_shared->skipped, 0);
+    LWLockRelease(ct_top_shared->lock);
+
+    PG_RETURN_VOID();
+}
+
+/*
+ * cascade_timestamp_top_keys_skipped() returns bigint
+ *
+ * The number of cascades, of every database, that were not counted because
+ * another backend held the sketch. NULL when the sketch is disabled.
+ */
+Datum
+cascade_timestamp_top_keys_skipped(PG_FUNCTION_ARGS){
+    if(ct_top == NULL)
+        PG_RETURN_NULL();
+
+    PG_RETURN_INT64((int64) pg_atomic_read_u64(&ct_top_shared->skipped));
+}
+
+/*
+ * Halve all counts if the decay interval passed. Halving every count keeps
+ * the heap ordered. Called with the lock held exclusively.
+ */
+static void
+ct_top_decay_counts(void){
+    TimestampTz now = GetCurrentStatementStartTimestamp();
+    int i;
+
+    if(ct_top_shared->decayed == 0)
+        ct_top_shared->decayed = now;
+
+    if(now - ct_top_shared->decayed < (TimestampTz) ct_top_decay * USECS_PER_SEC)
+        return;
+
+    for(i = 0; i < ct_top_shared->nused; i++){
+        ct_top_shared->slots[i].count /= 2;
+        ct_top_shared->slots[i].error /= 2;
+    }
+    ct_top_shared->decayed = now;
+}
+
+static void
+ct_top_sift_down(int slot){
+    CtTopSlot *slots = ct_top_shared->slots;
+    int n = ct_top_shared->nused;
+    int child;
+
+    for(;;){
+        child = 2 * slot + 1;
+        if(child >= n)
+            break;
+        if(child + 1 < n && slots[child + 1].count < slots[child].count)
+            child++;
+        if(slots[slot].count <= slots[child].count)
+            break;
+
+        ct_top_swap(slot, child);
+        slot = child;
+    }
+}
+
+static void
+ct_top_sift_up(int slot){
+    CtTopSlot *slots = ct_top_shared->slots;
+    int parent;
+
+    while(slot > 0){
+        parent = (slot - 1) / 2;
+        if(slots[parent].count <= slots[slot].count)
+            break;
+
+        ct_top_swap(slot, parent);
+        slot = parent;
+    }
+}
+
+static void
+ct_top_swap(int a, int b){
+    CtTopSlot *slots = ct_top_shared->slots;
+    CtTopSlot tmp;
+
+    tmp = slots[a];
+    slots[a] = slots[b];
+    slots[b] = tmp;
+    slots[a].entry->slot = a;
+    slots[b].entry->slot = b;
+}
+
+static int
+ct_top_item_cmp(const void *a, const void *b){
+    const CtTopItem *ia = (const CtTopItem *)a;
+    const CtTopItem *ib = (const CtTopItem *)b;
+
+    if(ia->count != ib->count)
+        return ia->count < ib->count ? 1 : -1;
+    return strcmp(ia->key, ib->key);
+}
@@ -0,0 +1,315 @@
+/*
+Copyright (c) 2014, Rick van Hattem <Wolph at wol.ph> - http://wol.ph/
+All rights reserved.
+
+Per-transaction bookkeeping of the destination keys a transaction cascaded
+to. The keys are deduplicated in a backend-local hash table that lives until
+the end of the transaction, when the transaction callback acts on them.
+
+`storage=lazy` keys are invalidated right away and once more when the
+transaction ends: a reader may have memoized a value computed before our
+child rows became visible (or one including them that was rolled back).
+Between PREPARE TRANSACTION and COMMIT PREPARED there is no backend left to
+invalidate them again, so such transactions cannot be prepared.
+
+`log=on` keys are appended to the delta log only once per transaction. The
+log row is transactional, so when the subtransaction that inserted it rolls
+back the key has to be logged again.
+
+`notify=channel` keys are sent right before commit with one NOTIFY per
+channel, the payload being an array literal of the deduplicated keys (split
+over several notifications if it does not fit in one). Keys of rolled back
+subtransactions are still sent; listeners have to cope with spurious keys
+anyway. Like NOTIFY itself they cannot be used in prepared transactions.
+*/
+
+#include "cascade_timestamp.h"
+
+#include "access/xact.h"
+#include "commands/async.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include <ctype.h>
+
+#ifndef NOTIFY_PAYLOAD_MAX_LENGTH
+#define NOTIFY_PAYLOAD_MAX_LENGTH   (BLCKSZ - NAMEDATALEN - 128)
+#endif
+
+typedef struct {
+    Oid destination;
+    int channel;    /* 1-based index in ct_channels, 0 if not notified */
+    char key[CT_MAX_KEY_LEN];
+} CtPendingKey;
+
+#define CT_PENDING_INVALIDATE   0x01
+#define CT_PENDING_LOG          0x02
+#define CT_PENDING_NOTIFY       0x04
+
+typedef struct {
+    CtPendingKey key;
+    int flags;
+    SubTransactionId logged;    /* subtransaction that inserted the log row */
+} CtPendingEntry;
+
+static MemoryContext ct_xact_context = NULL;
+static HTAB *ct_pending = NULL;
+static List *ct_channels = NIL;
+
+static void ct_xact_callback(XactEvent event, void *arg);
+static void ct_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+        SubTransactionId parentSubid, void *arg);
+static CtPendingEntry *ct_xact_remember(Oid destination, int channel,
+        const char *key);
+static void ct_xact_notify_all(void);
+static void ct_xact_quote_key(StringInfo buf, const char *key);
+
+void
+ct_xact_init(void){
+    RegisterXactCallback(ct_xact_callback, NULL);
+    RegisterSubXactCallback(ct_subxact_callback, NULL);
+}
+
+void
+ct_xact_invalidate(Oid destination, const char *key){
+    CtPendingEntry *entry;
+
+    ct_map_invalidate(destination, key);
+    entry = ct_xact_remember(destination, 0, key);
+    if(entry != NULL)
+        entry->flags |= CT_PENDING_INVALIDATE;
+}
+
+/*
+ * Returns true if the key was not logged yet in this transaction. Keys too
+ * long to remember are always logged.
+ */
+bool
+ct_xact_log(Oid destination, const char *key){
+    CtPendingEntry *entry;
+
+    entry = ct_xact_remember(destination, 0, key);
+    if(entry == NULL)
+        return true;
+    if(entry->flags & CT_PENDING_LOG)
+        return false;
+
+    entry->flags |= CT_PENDING_LOG;
+    entry->logged = GetCurrentSubTransactionId();
+    return true;
+}
+
+/* Send the key to the channel when the transaction commits */
+void
+ct_xact_notify(Oid destination, const char *channel, const char *key){
+    CtPendingEntry *entry;
+    StringInfoData payload;
+    MemoryContext oldcontext;
+    ListCell *lc;
+    int index = 1;
+
+    if(strlen(key) >= CT_MAX_KEY_LEN){
+        /* Async_Notify() takes care of deduplicating these */
+        initStringInfo(&payload);
+        appendStringInfoChar(&payload, '{');
+        ct_xact_quote_key(&payload, key);
+        appendStringInfoChar(&payload, '}');
+        Async_Notify(channel, payload.data);
+        pfree(payload.data);
+        return;
+    }
+
+    foreach(lc, ct_channels){
+        if(strcmp((char *)lfirst(lc), channel) == 0)
+            break;
+        index++;
+    }
+
+    entry = ct_xact_remember(destination, index, key);
+    entry->flags |= CT_PENDING_NOTIFY;
+
+    /* ct_xact_remember() created the context if it did not exist yet */
+    if(lc == NULL){
+        oldcontext = MemoryContextSwitchTo(ct_xact_context);
+        ct_channels = lappend(ct_channels, pstrdup(channel));
+        MemoryContextSwitchTo(oldcontext);
+    }
+}
+
+static CtPendingEntry *
+ct_xact_remember(Oid destination, int channel, const char *key){
+    CtPendingKey pkey;
+    CtPendingEntry *entry;
+    HASHCTL info;
+    bool found;
+
+    if(strlen(key) >= CT_MAX_KEY_LEN)
+        return NULL;
+
+    if(ct_pending == NULL){
+        if(ct_xact_context == NULL){
+            ct_xact_context = AllocSetContextCreate(TopMemoryContext,
+                    "cascade_timestamp pending keys", ALLOCSET_DEFAULT_SIZES);
+        }
+
+        MemSet(&info, 0, sizeof(info));
+        info.keysize = sizeof(CtPendingKey);
+        info.entrysize = sizeof(CtPendingEntry);
+        info.hcxt = ct_xact_context;
+        ct_pending = hash_create("cascade_timestamp pending keys", 256,
+                &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+
+    MemSet(&pkey, 0, sizeof(pkey));
+    pkey.destination = destination;
+    pkey.channel = channel;
+    strlcpy(pkey.key, key, CT_MAX_KEY_LEN);
+
+    entry = (CtPendingEntry *)hash_search(ct_pending, &pkey, HASH_ENTER,
+            &found);
+    if(!found)
+        entry->flags = 0;
+
+    return entry;
+}
+
+static void
+ct_xact_callback(XactEvent event, void *arg){
+    HASH_SEQ_STATUS status;
+    CtPendingEntry *entry;
+
+    if(ct_pending == NULL)
+        return;
+
+    switch(event){
+        case XACT_EVENT_PRE_COMMIT:
+            ct_xact_notify_all();
+            break;
+        case XACT_EVENT_PRE_PREPARE:
+            hash_seq_init(&status, ct_pending);
+            while((entry = (CtPendingEntry *)hash_seq_search(&status)) != NULL){
+                if(entry->flags & CT_PENDING_INVALIDATE){
+                    hash_seq_term(&status);
+                    elog(ERROR, "cascade_timestamp: cannot PREPARE a transaction that cascaded to a storage=lazy destination");
+                }
+                if(entry->flags & CT_PENDING_NOTIFY){
+                    hash_seq_term(&status);
+                    elog(ERROR, "cascade_timestamp: cannot PREPARE a transaction that has pending notify= keys");
+                }
+            }
+            break;
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PREPARE:
+            hash_seq_init(&status, ct_pending);
+            while((entry = (CtPendingEntry *)hash_seq_search(&status)) != NULL){
+                if(entry->flags & CT_PENDING_INVALIDATE)
+                    ct_map_invalidate(entry->key.destination, entry->key.key);
+            }
+
+            ct_pending = NULL;
+            ct_channels = NIL;
+            MemoryContextReset(ct_xact_context);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Runs before PreCommit_Notify(), so the notifications queued here are sent
+ * with this commit.
+ */
+static void
+ct_xact_notify_all(void){
+    HASH_SEQ_STATUS status;
+    CtPendingEntry *entry;
+    StringInfoData payload;
+    StringInfoData quoted;
+    ListCell *lc;
+    int index = 1;
+
+    initStringInfo(&payload);
+    initStringInfo(&quoted);
+
+    foreach(lc, ct_channels){
+        resetStringInfo(&payload);
+
+        hash_seq_init(&status, ct_pending);
+        while((entry = (CtPendingEntry *)hash_seq_search(&status)) != NULL){
+            if(!(entry->flags & CT_PENDING_NOTIFY) ||
+                    entry->key.channel != index)
+                continue;
+
+            resetStringInfo(&quoted);
+            ct_xact_quote_key(&quoted, entry->key.key);
+
+            /* room for the separator, the closing brace and the NUL */
+            if(payload.len > 0 &&
+                    payload.len + quoted.len + 3 > NOTIFY_PAYLOAD_MAX_LENGTH){
+                appendStringInfoChar(&payload, '}');
+                Async_Notify((char *)lfirst(lc), payload.data);
+                resetStringInfo(&payload);
+            }
+
+            appendStringInfoChar(&payload, payload.len == 0 ? '{' : ',');
+            appendBinaryStringInfo(&payload, quoted.data, quoted.len);
+        }
+
+        if(payload.len > 0){
+            appendStringInfoChar(&payload, '}');
+            Async_Notify((char *)lfirst(lc), payload.data);
+        }
+        index++;
+    }
+
+    pfree(payload.data);
+    pfree(quoted.data);
+}
+
+/* Quote a key the way array_out() would */
+static void
+ct_xact_quote_key(StringInfo buf, const char *key){
+    const char *p;
+    bool quote = (*key == '\0' || pg_strcasecmp(key, "NULL") == 0);
+
+    for(p = key; *p && !quote; p++){
+        if(*p == '{' || *p == '}' || *p == ',' || *p == '"' || *p == '\\' ||
+                isspace((unsigned char) *p))
+            quote = true;
+    }
+
+    if(!quote){
+        appendStringInfoString(buf, key);
+        return;
+    }
+
+    appendStringInfoChar(buf, '"');
+    for(p = key; *p; p++){
+        if(*p == '"' || *p == '\\')
+            appendStringInfoChar(buf, '\\');
+        appendStringInfoChar(buf, *p);
+    }
+    appendStringInfoChar(buf, '"');
+}
+
+/*
+ * Subtransaction ids only grow, so everything logged at or after the
+ * aborted subtransaction was logged by it or one of its children.
+ */
+static void
+ct_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+        SubTransactionId parentSubid, void *arg){
+    HASH_SEQ_STATUS status;
+    CtPendingEntry *entry;
+
+    if(ct_pending == NULL || event != SUBXACT_EVENT_ABORT_SUB)
+        return;
+
+    hash_seq_init(&status, ct_pending);
+    while((entry = (CtPendingEntry *)hash_seq_search(&status)) != NULL){
+        if((entry->flags & CT_PENDING_LOG) && entry->logged >= mySubid)
+            entry->flags &= ~CT_PENDING_LOG;
+    }
+}
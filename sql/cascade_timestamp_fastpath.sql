@@ -0,0 +1,67 @@
+--
+-- fastpath=on updates the destination row directly, also when foreign keys
+-- reference it and their triggers fire on the update
+--
+CREATE FUNCTION cascade_timestamp() RETURNS trigger
+AS 'cascade_timestamp.so' LANGUAGE C;
+CREATE TABLE forum (
+    id integer PRIMARY KEY
+);
+CREATE TABLE topic (
+    id integer PRIMARY KEY,
+    forum_id integer NOT NULL REFERENCES forum,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE post (
+    id integer PRIMARY KEY,
+    topic_id integer NOT NULL REFERENCES topic
+);
+CREATE TRIGGER post_cascade AFTER INSERT OR UPDATE OR DELETE ON post
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(topic, updated_at, id, topic_id, 'fastpath=on');
+INSERT INTO forum VALUES (1);
+INSERT INTO topic (id, forum_id) VALUES (1, 1), (2, 1), (3, 1);
+-- The cascades of a statement share the open destination
+INSERT INTO post VALUES (1, 1), (2, 1), (3, 2);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM topic ORDER BY id;
+UPDATE topic SET updated_at = '2000-01-01';
+UPDATE post SET topic_id = 3 WHERE id = 3;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM topic ORDER BY id;
+UPDATE topic SET updated_at = '2000-01-01';
+DELETE FROM post WHERE id = 1;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM topic ORDER BY id;
+-- COPY leaves the destination open until the next utility statement
+UPDATE topic SET updated_at = '2000-01-01';
+BEGIN;
+COPY post FROM stdin;
+4	3
+\.
+ALTER TABLE topic ADD COLUMN title text;
+COMMIT;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM topic ORDER BY id;
+-- destination_where= is left to the UPDATE, which checks it before locking
+DROP TRIGGER post_cascade ON post;
+CREATE TRIGGER post_cascade AFTER INSERT OR UPDATE OR DELETE ON post
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(topic, updated_at, id, topic_id, 'fastpath=on',
+    'destination_where=id < 3');
+UPDATE topic SET updated_at = '2000-01-01';
+INSERT INTO post VALUES (5, 1), (6, 3);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM topic ORDER BY id;
+-- The timestamp is rounded to the precision of the column
+CREATE TABLE thread (
+    id integer PRIMARY KEY,
+    updated_at timestamptz(0) NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE reply (
+    id integer PRIMARY KEY,
+    thread_id integer NOT NULL REFERENCES thread
+);
+CREATE TRIGGER reply_cascade AFTER INSERT OR UPDATE OR DELETE ON reply
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(thread, updated_at, id, thread_id, 'fastpath=on');
+INSERT INTO thread (id) VALUES (1);
+INSERT INTO reply VALUES (1, 1);
+SELECT updated_at > '2000-01-01' AS cascaded,
+    updated_at = date_trunc('second', updated_at) AS rounded
+FROM thread;
@@ -0,0 +1,87 @@
+--
+-- The (source_column, value) pairs compare pass-by-value columns as values,
+-- text and varchar columns in place and anything else through the output
+-- function. A NULL column never rejects a row.
+--
+CREATE OR REPLACE FUNCTION cascade_timestamp() RETURNS trigger
+AS 'cascade_timestamp.so' LANGUAGE C;
+CREATE SCHEMA filters;
+SET search_path = filters, public;
+CREATE TABLE item (
+    id integer PRIMARY KEY,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE entry (
+    id integer PRIMARY KEY,
+    item_id integer NOT NULL,
+    flag boolean,
+    rank integer,
+    status text,
+    score numeric
+);
+INSERT INTO item (id) VALUES (1), (2), (3), (4);
+-- Typed: 't' matches true like 'true' would, '007' matches 7
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, flag, 't', rank, '007');
+INSERT INTO entry (id, item_id, flag, rank) VALUES
+    (1, 1, true, 7), (2, 2, false, 7), (3, 3, true, 8), (4, 4, NULL, NULL);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+DROP TRIGGER entry_cascade ON entry;
+DELETE FROM entry;
+UPDATE item SET updated_at = '2000-01-01';
+-- Text: compared byte for byte
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, status, 'open');
+INSERT INTO entry (id, item_id, status) VALUES
+    (1, 1, 'open'), (2, 2, 'open '), (3, 3, 'Open'), (4, 4, NULL);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+DROP TRIGGER entry_cascade ON entry;
+DELETE FROM entry;
+UPDATE item SET updated_at = '2000-01-01';
+-- Output: numeric 1 is '1', not '1.0'
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, score, '1.0');
+INSERT INTO entry (id, item_id, score) VALUES
+    (1, 1, 1.0), (2, 2, 1), (3, 3, 1.00), (4, 4, NULL);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+DROP TRIGGER entry_cascade ON entry;
+DELETE FROM entry;
+UPDATE item SET updated_at = '2000-01-01';
+-- An UPDATE is filtered on the row before it
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, flag, 'true');
+INSERT INTO entry (id, item_id, flag) VALUES (1, 1, false), (2, 2, true);
+UPDATE item SET updated_at = '2000-01-01';
+UPDATE entry SET flag = NOT flag;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+DROP TRIGGER entry_cascade ON entry;
+DELETE FROM entry;
+UPDATE item SET updated_at = '2000-01-01';
+-- Unlike a NULL column, a NULL where= result rejects the row
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, flag, 't', 'where=rank > 5');
+INSERT INTO entry (id, item_id, flag, rank) VALUES
+    (1, 1, NULL, 6), (2, 2, NULL, NULL), (3, 3, true, 5), (4, 4, true, 6);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+DROP TRIGGER entry_cascade ON entry;
+DELETE FROM entry;
+UPDATE item SET updated_at = '2000-01-01';
+-- The value has to be valid input for a pass-by-value column
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, rank, 'x');
+INSERT INTO entry (id, item_id, rank) VALUES (1, 1, 1);
+INSERT INTO entry (id, item_id, rank) VALUES (1, 1, 1);
+-- A filter column without a value
+DROP TRIGGER entry_cascade ON entry;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, rank);
+INSERT INTO entry (id, item_id, rank) VALUES (1, 1, 1);
+DROP TABLE entry, item;
+DROP SCHEMA filters;
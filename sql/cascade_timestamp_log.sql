@@ -0,0 +1,52 @@
+--
+-- log=on appends every destination key a transaction cascaded to once to
+-- cascade_timestamp_log, for the consumers of cascade_timestamp_log_read()
+--
+-- The SQL functions and tables of cascade_timestamp.sql
+SET client_min_messages = warning;
+\set ECHO none
+\i cascade_timestamp.sql
+\set ECHO all
+RESET client_min_messages;
+CREATE SCHEMA delta;
+SET search_path = delta, public;
+CREATE TABLE item (
+    id integer PRIMARY KEY,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE entry (
+    id integer PRIMARY KEY,
+    item_id integer NOT NULL,
+    visible boolean
+);
+INSERT INTO item (id) VALUES (1), (2), (3);
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, visible, 'true', 'log=on');
+SELECT cascade_timestamp_log_subscribe('indexer');
+-- Filtered rows are neither logged nor cascaded
+INSERT INTO entry VALUES (1, 1, true), (2, 1, true), (3, 2, true),
+    (4, 3, false);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+SELECT destination, key FROM cascade_timestamp_log_read('indexer');
+-- Until it is acknowledged the batch is read again
+SELECT destination, key FROM cascade_timestamp_log_read('indexer');
+SELECT cascade_timestamp_log_ack('indexer') AS acked;
+-- Every key once per transaction
+BEGIN;
+UPDATE entry SET visible = false WHERE id <= 2;
+DELETE FROM entry WHERE id = 1;
+COMMIT;
+SELECT destination, key FROM cascade_timestamp_log_read('indexer');
+SELECT cascade_timestamp_log_ack('indexer') AS acked;
+SELECT destination, key FROM cascade_timestamp_log_read('indexer');
+-- log= takes a boolean
+DROP TRIGGER entry_cascade ON entry;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, 'log=maybe');
+INSERT INTO entry VALUES (5, 1, true);
+SELECT cascade_timestamp_log_unsubscribe('indexer');
+DELETE FROM public.cascade_timestamp_log;
+DROP TABLE entry, item;
+DROP SCHEMA delta;
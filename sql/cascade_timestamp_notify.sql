@@ -0,0 +1,36 @@
+--
+-- notify=channel collects the keys of a transaction and sends them with
+-- one NOTIFY per channel at commit. psql prints the sender's pid with a
+-- notification, so only the cascade and the commit are checked here.
+--
+CREATE OR REPLACE FUNCTION cascade_timestamp() RETURNS trigger
+AS 'cascade_timestamp.so' LANGUAGE C;
+CREATE SCHEMA notify;
+SET search_path = notify, public;
+CREATE TABLE item (
+    id integer PRIMARY KEY,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE entry (
+    id integer PRIMARY KEY,
+    item_id integer NOT NULL,
+    visible boolean
+);
+INSERT INTO item (id) VALUES (1), (2), (3);
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, visible, 'true',
+    'notify=item_changed');
+BEGIN;
+INSERT INTO entry VALUES (1, 1, true), (2, 1, true), (3, 2, false);
+DELETE FROM entry WHERE id = 2;
+COMMIT;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+-- An empty channel name is an error
+DROP TRIGGER entry_cascade ON entry;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, 'notify=');
+INSERT INTO entry VALUES (5, 1, true);
+DROP TABLE entry, item;
+DROP SCHEMA notify;
@@ -0,0 +1,45 @@
+--
+-- storage=sidecar upserts the timestamp into the sidecar table and leaves
+-- the destination row alone
+--
+-- The SQL functions and tables of cascade_timestamp.sql
+SET client_min_messages = warning;
+\set ECHO none
+\i cascade_timestamp.sql
+\set ECHO all
+RESET client_min_messages;
+CREATE SCHEMA sidecar;
+SET search_path = sidecar, public;
+CREATE TABLE item (
+    id integer PRIMARY KEY,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE entry (
+    id integer PRIMARY KEY,
+    item_id integer NOT NULL,
+    visible boolean
+);
+INSERT INTO item (id) VALUES (1), (2), (3);
+SELECT cascade_timestamp_sidecar('item', 'updated_at', 'id') IS NOT NULL
+    AS created;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, visible, 'true',
+    'storage=sidecar');
+INSERT INTO entry VALUES (1, 1, true), (2, 1, true), (3, 2, false);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+SELECT id FROM item_cascade_timestamp ORDER BY id;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item_cascaded
+ORDER BY id;
+-- A new key is inserted into the sidecar, a known one updated
+INSERT INTO entry VALUES (4, 1, true), (5, 2, true);
+SELECT id FROM item_cascade_timestamp ORDER BY id;
+-- An unknown storage is an error
+DROP TRIGGER entry_cascade ON entry;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, 'storage=sidetable');
+INSERT INTO entry VALUES (6, 1, true);
+DROP VIEW item_cascaded;
+DROP TABLE item_cascade_timestamp, entry, item;
+DROP SCHEMA sidecar;
@@ -0,0 +1,45 @@
+--
+-- where= only cascades the rows for which the expression is true, it is
+-- evaluated on the row before an UPDATE
+--
+CREATE OR REPLACE FUNCTION cascade_timestamp() RETURNS trigger
+AS 'cascade_timestamp.so' LANGUAGE C;
+CREATE SCHEMA predicate;
+SET search_path = predicate, public;
+CREATE TABLE item (
+    id integer PRIMARY KEY,
+    updated_at timestamptz NOT NULL DEFAULT '2000-01-01'
+);
+CREATE TABLE entry (
+    id integer PRIMARY KEY,
+    item_id integer NOT NULL,
+    status text,
+    score integer
+);
+INSERT INTO item (id) VALUES (1), (2), (3), (4);
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id,
+    'where=status IN (''published'', ''pinned'') AND score > 0');
+-- A NULL result rejects the row
+INSERT INTO entry VALUES
+    (1, 1, 'published', 1), (2, 2, 'draft', 1), (3, 3, 'pinned', 0),
+    (4, 4, 'pinned', NULL);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+UPDATE item SET updated_at = '2000-01-01';
+UPDATE entry SET score = 0 WHERE id = 1;
+UPDATE entry SET score = 5 WHERE id = 3;
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+-- The expression is compiled again after the table changed
+ALTER TABLE entry ALTER COLUMN score TYPE bigint;
+UPDATE item SET updated_at = '2000-01-01';
+DELETE FROM entry WHERE id IN (3, 4);
+SELECT id, updated_at > '2000-01-01' AS cascaded FROM item ORDER BY id;
+-- Anything but a single expression is rejected
+DROP TRIGGER entry_cascade ON entry;
+CREATE TRIGGER entry_cascade AFTER INSERT OR UPDATE OR DELETE ON entry
+FOR EACH ROW EXECUTE PROCEDURE
+cascade_timestamp(item, updated_at, id, item_id, 'where=score > 0; SELECT 1');
+INSERT INTO entry VALUES (5, 1, 'published', 1);
+DROP TABLE entry, item;
+DROP SCHEMA predicate;